@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "quadtree.h"
+#include "simulation.h"
+
+// Проверка точности гравитации против прямого суммирования:
+//   solar_sim_accuracy [количество потоков]
+// Для набора начальных распределений с фиксированными зёрнами выводит
+// среднеквадратичную и наибольшую относительную ошибку ускорения тела для
+// каждого метода, а для коротких прогонов — дрейф полной энергии и момента
+// импульса с тем же методом и с прямым суммированием. Код возврата 1, если
+// ошибка сил или дрейф превышает допуск случая: так изменения дерева не могут
+// незаметно ухудшить физику.
+
+namespace {
+
+struct SolverCase {
+  const char* name;
+  int solver;
+  float theta;
+  int fmm_order;
+  // Допуски: среднеквадратичная ошибка ускорений и дрейф за прогон, с
+  // запасом в 2–3 раза к значениям сборки float
+  double max_force_rms;
+  double max_energy_drift;
+  double max_momentum_drift;
+};
+
+// Первый случай — эталон, с которым сравниваются силы остальных
+const SolverCase kSolverCases[] = {
+    {"direct", SOLVER_DIRECT, 0.0f, 0, 0.0, 3e-4, 1e-7},
+    {"bh 0.5", SOLVER_BARNES_HUT, 0.5f, 0, 2e-3, 3e-4, 2e-5},
+    {"bh 0.7", SOLVER_BARNES_HUT, 0.7f, 0, 2e-2, 3e-4, 3e-5},
+    {"bh 1.0", SOLVER_BARNES_HUT, 1.0f, 0, 8e-2, 1e-3, 5e-4},
+    {"fmm 4", SOLVER_FMM, 0.5f, 4, 2e-3, 3e-4, 3e-6},
+};
+
+struct Distribution {
+  int seed;
+  int bodies;
+};
+
+// Распределения для ошибки сил и для прогонов с дрейфом
+const Distribution kForceDistributions[] = {{1, 2000}, {2, 2000}, {1, 20000}};
+const Distribution kDriftDistribution = {1, 2000};
+constexpr int kDriftSteps = 500;
+
+SimulationParameters make_parameters(const Distribution& distribution,
+                                     const SolverCase& solver,
+                                     int num_threads) {
+  SimulationParameters params;
+  params.NUM_BODIES = distribution.bodies;
+  params.INITIALIZATION_RADIUS *= std::sqrt(distribution.bodies / 1000.0f);
+  params.SEED = distribution.seed;
+  params.DETERMINISTIC = 1;
+  params.NUM_THREADS = num_threads;
+  params.SOLVER = solver.solver;
+  params.THETA = solver.theta;
+  params.FMM_ORDER = solver.fmm_order;
+  // Плотные тела почти не сливаются, и слияния не искажают дрейф энергии
+  params.DENSITY = 1e6f;
+  return params;
+}
+
+// Ускорения тел по id
+std::vector<double> accelerations_by_id(std::vector<CelestialBody>& bodies,
+                                        const SimulationParameters& params,
+                                        SimulationWorkspace& workspace) {
+  Boundary boundary = {0.0f, 0.0f, params.INITIALIZATION_RADIUS * 2.0f};
+  Quadtree qtree(boundary, 4);
+  calculate_accelerations(bodies, qtree, params, workspace);
+  int max_id = 0;
+  for (const CelestialBody& body : bodies) max_id = std::max(max_id, body.id);
+  std::vector<double> result(2 * (max_id + 1), 0.0);
+  for (const CelestialBody& body : bodies) {
+    result[2 * body.id] = body.ax;
+    result[2 * body.id + 1] = body.ay;
+  }
+  return result;
+}
+
+struct Invariants {
+  double energy;
+  double angular_momentum;
+};
+
+Invariants measure(const std::vector<CelestialBody>& bodies,
+                   const SimulationParameters& params,
+                   SimulationWorkspace& workspace) {
+  Invariants result = {0.0, 0.0};
+  for (const CelestialBody& body : bodies) {
+    const double vx = body.vx;
+    const double vy = body.vy;
+    result.energy += 0.5 * body.mass * (vx * vx + vy * vy);
+    result.angular_momentum +=
+        body.mass * (static_cast<double>(body.x) * vy - body.y * vx);
+  }
+  result.energy += workspace.direct.calculate_potential_energy(
+      bodies, workspace.pool, params.G, params.SOFTENING_FACTOR);
+  return result;
+}
+
+bool check(double value, double limit) { return value <= limit; }
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int num_threads = 0;
+  if (argc > 1) num_threads = std::atoi(argv[1]);
+  bool passed = true;
+
+  std::printf("Force error relative to direct summation\n");
+  std::printf("%6s %7s %-8s %12s %12s\n", "seed", "bodies", "solver",
+              "rms", "max");
+  for (const Distribution& distribution : kForceDistributions) {
+    const SolverCase& reference_case = kSolverCases[0];
+    SimulationParameters params =
+        make_parameters(distribution, reference_case, num_threads);
+    std::vector<CelestialBody> initial;
+    initialize_bodies(initial, params);
+    SimulationWorkspace workspace;
+    std::vector<CelestialBody> bodies = initial;
+    const std::vector<double> reference =
+        accelerations_by_id(bodies, params, workspace);
+
+    for (const SolverCase& solver : kSolverCases) {
+      if (&solver == &reference_case) continue;
+      params = make_parameters(distribution, solver, num_threads);
+      bodies = initial;
+      const std::vector<double> accelerations =
+          accelerations_by_id(bodies, params, workspace);
+      double sum_sq = 0.0;
+      double max_error = 0.0;
+      for (const CelestialBody& body : initial) {
+        const double rx = reference[2 * body.id];
+        const double ry = reference[2 * body.id + 1];
+        const double dx = accelerations[2 * body.id] - rx;
+        const double dy = accelerations[2 * body.id + 1] - ry;
+        const double error =
+            std::sqrt((dx * dx + dy * dy) / (rx * rx + ry * ry));
+        sum_sq += error * error;
+        max_error = std::max(max_error, error);
+      }
+      const double rms = std::sqrt(sum_sq / initial.size());
+      const bool ok = check(rms, solver.max_force_rms);
+      passed = passed && ok;
+      std::printf("%6d %7d %-8s %12.3e %12.3e%s\n", distribution.seed,
+                  distribution.bodies, solver.name, rms, max_error,
+                  ok ? "" : "  FAIL");
+    }
+  }
+
+  std::printf("\nDrift over %d steps, seed %d, %d bodies\n", kDriftSteps,
+              kDriftDistribution.seed, kDriftDistribution.bodies);
+  std::printf("%-8s %12s %12s %8s\n", "solver", "energy", "momentum",
+              "merges");
+  for (const SolverCase& solver : kSolverCases) {
+    SimulationParameters params =
+        make_parameters(kDriftDistribution, solver, num_threads);
+    std::vector<CelestialBody> bodies;
+    initialize_bodies(bodies, params);
+    Boundary boundary = {0.0f, 0.0f, params.INITIALIZATION_RADIUS * 2.0f};
+    Quadtree qtree(boundary, 4);
+    SimulationWorkspace workspace;
+    // Первый шаг сливает перекрывающиеся тела начального распределения
+    update_simulation(bodies, qtree, params, workspace);
+    const Invariants start = measure(bodies, params, workspace);
+    int64_t merges = 0;
+    for (int step = 0; step < kDriftSteps; ++step) {
+      update_simulation(bodies, qtree, params, workspace);
+      merges += workspace.merge_events.size();
+    }
+    const Invariants end = measure(bodies, params, workspace);
+    const double energy_drift =
+        std::abs((end.energy - start.energy) / start.energy);
+    const double momentum_drift =
+        std::abs((end.angular_momentum - start.angular_momentum) /
+                 start.angular_momentum);
+    const bool ok = check(energy_drift, solver.max_energy_drift) &&
+                    check(momentum_drift, solver.max_momentum_drift);
+    passed = passed && ok;
+    std::printf("%-8s %12.3e %12.3e %8lld%s\n", solver.name, energy_drift,
+                momentum_drift, static_cast<long long>(merges),
+                ok ? "" : "  FAIL");
+  }
+  return passed ? 0 : 1;
+}
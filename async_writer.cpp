@@ -0,0 +1,68 @@
+#include "async_writer.h"
+
+#include <utility>
+
+AsyncWriter::AsyncWriter(size_t max_queued_bytes)
+    : max_queued_bytes_(max_queued_bytes), thread_([this] { run(); }) {}
+
+AsyncWriter::~AsyncWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_cv_.notify_one();
+  thread_.join();
+}
+
+bool AsyncWriter::has_space(size_t bytes) const {
+  return queued_bytes_ == 0 || queued_bytes_ + bytes <= max_queued_bytes_;
+}
+
+void AsyncWriter::submit(std::function<void()> task, size_t bytes) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_cv_.wait(lock, [&] { return has_space(bytes); });
+    tasks_.push_back({std::move(task), bytes});
+    queued_bytes_ += bytes;
+  }
+  task_cv_.notify_one();
+}
+
+bool AsyncWriter::try_submit(std::function<void()> task, size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!has_space(bytes)) {
+      return false;
+    }
+    tasks_.push_back({std::move(task), bytes});
+    queued_bytes_ += bytes;
+  }
+  task_cv_.notify_one();
+  return true;
+}
+
+void AsyncWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  space_cv_.wait(lock, [&] { return tasks_.empty() && !busy_; });
+}
+
+void AsyncWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    task_cv_.wait(lock, [&] { return stopping_ || !tasks_.empty(); });
+    if (tasks_.empty()) {
+      return;  // остановка после выполнения всех задач
+    }
+    Task task = std::move(tasks_.front());
+    tasks_.pop_front();
+    busy_ = true;
+    lock.unlock();
+    task.run();
+    // Буферы задачи освобождаются до того, как их объём вернётся в очередь
+    task.run = nullptr;
+    lock.lock();
+    busy_ = false;
+    queued_bytes_ -= task.bytes;
+    space_cv_.notify_all();
+  }
+}
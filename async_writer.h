@@ -0,0 +1,51 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Фоновый поток записи на диск. Задачи выполняются по очереди в потоке
+// ввода-вывода, а цикл шагов только копирует данные в буферы задач.
+//
+// Очередь ограничена объёмом данных, которые держат задачи, включая
+// выполняемую: submit() ждёт места, а try_submit() отказывается от задачи,
+// если места нет. Задача больше всей очереди принимается, когда очередь пуста.
+class AsyncWriter {
+ public:
+  explicit AsyncWriter(size_t max_queued_bytes = 256u << 20);
+  // Выполняет оставшиеся задачи
+  ~AsyncWriter();
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  void submit(std::function<void()> task, size_t bytes);
+  bool try_submit(std::function<void()> task, size_t bytes);
+  // Ждёт выполнения всех поставленных задач
+  void flush();
+
+ private:
+  struct Task {
+    std::function<void()> run;
+    size_t bytes;
+  };
+
+  size_t max_queued_bytes_;
+  size_t queued_bytes_ = 0;
+  bool busy_ = false;
+  bool stopping_ = false;
+  std::deque<Task> tasks_;
+  std::mutex mutex_;
+  std::condition_variable task_cv_;   // новая задача или остановка
+  std::condition_variable space_cv_;  // задача выполнена
+  std::thread thread_;
+
+  bool has_space(size_t bytes) const;
+  void run();
+};
+
+#endif  // ASYNC_WRITER_H
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "profiler.h"
+#include "quadtree.h"
+#include "simulation.h"
+
+// Время этапов шага в наносекундах для разного числа тел:
+//   solar_sim_benchmark [наибольшее число тел] [количество потоков] [зерно]
+// Плотность тел одинакова для всех размеров: радиус начального диска растёт
+// как корень из числа тел. Прогоны воспроизводимые (DETERMINISTIC, зерно 1 по
+// умолчанию): хеши состояния после каждого шага сворачиваются в столбец hash,
+// который совпадает между запусками и при любом числе потоков, пока изменение
+// не затрагивает результат.
+int main(int argc, char* argv[]) {
+  int max_bodies = 1000000;
+  int num_threads = 0;
+  int seed = 1;
+  if (argc > 1) max_bodies = std::atoi(argv[1]);
+  if (argc > 2) num_threads = std::atoi(argv[2]);
+  if (argc > 3) seed = std::atoi(argv[3]);
+
+  std::printf("%9s %6s", "bodies", "steps");
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    std::printf(" %12s", get_phase_name(phase));
+  }
+  std::printf(" %12s %16s\n", "total ns", "hash");
+
+  for (int body_count = 1000; body_count <= max_bodies; body_count *= 10) {
+    SimulationParameters params;
+    params.NUM_BODIES = body_count;
+    params.INITIALIZATION_RADIUS *= std::sqrt(body_count / 1000.0f);
+    params.NUM_THREADS = num_threads;
+    params.SEED = seed;
+    params.DETERMINISTIC = 1;
+    int steps = std::min(std::max(2000000 / body_count, 5), 500);
+
+    std::vector<CelestialBody> bodies;
+    initialize_bodies(bodies, params);
+    Boundary boundary = {0.0f, 0.0f, params.INITIALIZATION_RADIUS * 2.0f};
+    Quadtree qtree(boundary, 4);
+    SimulationWorkspace workspace;
+
+    // Первый шаг сливает перекрывающиеся тела начального распределения и
+    // выделяет память, в замер он не входит
+    update_simulation(bodies, qtree, params, workspace);
+    workspace.phase_times.clear();
+    uint64_t hash = hash_bodies(bodies);
+    for (int i = 0; i < steps; ++i) {
+      update_simulation(bodies, qtree, params, workspace);
+      hash = hash * 31 + hash_bodies(bodies);
+    }
+
+    const PhaseTimes& times = workspace.phase_times;
+    int64_t total = 0;
+    std::printf("%9zu %6d", bodies.size(), steps);
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+      int64_t per_step = times.nanoseconds[phase] / times.step_count;
+      total += per_step;
+      std::printf(" %12lld", static_cast<long long>(per_step));
+    }
+    std::printf(" %12lld %016llx\n", static_cast<long long>(total),
+                static_cast<unsigned long long>(hash));
+  }
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include "broad_phase.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "simulation.h"
+
+namespace {
+
+// Тела с радиусом больше среднего во столько раз не попадают в сетку
+constexpr float kLargeRadiusFactor = 4.0f;
+
+// Координаты ячеек ограничены, чтобы далёкие тела не переполняли int
+constexpr float kMaxCell = 1 << 30;
+
+}  // namespace
+
+const std::vector<CollisionPair>& BroadPhase::find_overlapping_pairs(
+    const std::vector<CelestialBody>& bodies) {
+  pairs_.clear();
+  pair_test_count_ = 0;
+  const int body_count = static_cast<int>(bodies.size());
+  if (body_count < 2) {
+    return pairs_;
+  }
+
+  // 1. Размер ячейки: пересекающиеся обычные тела лежат в соседних ячейках
+  float radius_sum = 0.0f;
+  for (const CelestialBody& body : bodies) {
+    radius_sum += body.radius;
+  }
+  const float large_radius = kLargeRadiusFactor * radius_sum / body_count;
+  large_bodies_.clear();
+  max_small_radius_ = 0.0f;
+  for (int i = 0; i < body_count; ++i) {
+    if (bodies[i].radius > large_radius) {
+      large_bodies_.push_back(i);
+    } else {
+      max_small_radius_ = std::max(max_small_radius_, bodies[i].radius);
+    }
+  }
+  float cell_size = max_small_radius_ > 0.0f ? 2.0f * max_small_radius_ : 1.0f;
+  inverse_cell_size_ = 1.0f / cell_size;
+
+  // 2. Раскладываем обычные тела по корзинам сортировкой подсчётом. Корзин
+  // не меньше двух на тело, чтобы разные ячейки редко делили корзину.
+  int bucket_bits = 1;
+  while ((1u << bucket_bits) < 2u * static_cast<uint32_t>(body_count)) {
+    ++bucket_bits;
+  }
+  column_bits_ = (bucket_bits + 1) / 2;
+  column_mask_ = (1u << column_bits_) - 1;
+  row_mask_ = (1u << (bucket_bits - column_bits_)) - 1;
+  const uint32_t bucket_count = 1u << bucket_bits;
+  bucket_start_.assign(bucket_count + 1, 0);
+  entries_.clear();
+  entry_buckets_.clear();
+  for (int i = 0; i < body_count; ++i) {
+    const CelestialBody& body = bodies[i];
+    if (body.radius > large_radius) continue;
+    GridEntry entry = {
+        body.x, body.y, body.radius, i, to_cell(body.x), to_cell(body.y)};
+    uint32_t bucket = cell_bucket(entry.cell_x, entry.cell_y);
+    entries_.push_back(entry);
+    entry_buckets_.push_back(bucket);
+    ++bucket_start_[bucket + 1];
+  }
+  for (uint32_t bucket = 0; bucket < bucket_count; ++bucket) {
+    bucket_start_[bucket + 1] += bucket_start_[bucket];
+  }
+  sorted_.resize(entries_.size());
+  for (size_t k = 0; k < entries_.size(); ++k) {
+    sorted_[bucket_start_[entry_buckets_[k]]++] = entries_[k];
+  }
+  // После заполнения начало каждой корзины сдвинулось на её конец
+  for (uint32_t bucket = bucket_count; bucket > 0; --bucket) {
+    bucket_start_[bucket] = bucket_start_[bucket - 1];
+  }
+  bucket_start_[0] = 0;
+
+  // 3. Пары обычных тел, затем пары с участием крупных
+  find_small_pairs();
+  find_large_pairs(bodies);
+
+  // 4. Порядок пар по id тел, а не по обходу сетки: слияния разрешаются
+  // одинаково при любом порядке тел в массиве
+  for (CollisionPair& pair : pairs_) {
+    if (bodies[pair.second].id < bodies[pair.first].id) {
+      std::swap(pair.first, pair.second);
+    }
+  }
+  std::sort(pairs_.begin(), pairs_.end(),
+            [&bodies](const CollisionPair& a, const CollisionPair& b) {
+              const int a_first = bodies[a.first].id;
+              const int b_first = bodies[b.first].id;
+              if (a_first != b_first) return a_first < b_first;
+              return bodies[a.second].id < bodies[b.second].id;
+            });
+  return pairs_;
+}
+
+int BroadPhase::to_cell(Real coordinate) const {
+  Real cell = std::floor(coordinate * inverse_cell_size_);
+  return static_cast<int>(
+      std::min<Real>(std::max<Real>(cell, -kMaxCell), kMaxCell));
+}
+
+uint32_t BroadPhase::cell_bucket(int x, int y) const {
+  return ((static_cast<uint32_t>(y) & row_mask_) << column_bits_) |
+         (static_cast<uint32_t>(x) & column_mask_);
+}
+
+void BroadPhase::add_if_overlapping(const GridEntry& a, const GridEntry& b) {
+  ++pair_test_count_;
+  Real dx = b.x - a.x;
+  Real dy = b.y - a.y;
+  float radius_sum = a.radius + b.radius;
+  if (dx * dx + dy * dy < radius_sum * radius_sum) {
+    pairs_.push_back({std::min(a.index, b.index), std::max(a.index, b.index)});
+  }
+}
+
+void BroadPhase::scan_cell(const GridEntry& entry, int cell_x, int cell_y,
+                           bool later_only) {
+  // В корзине могут оказаться тела других ячеек с тем же номером по модулю,
+  // их отсекает сравнение координат ячейки
+  uint32_t bucket = cell_bucket(cell_x, cell_y);
+  for (int k = bucket_start_[bucket]; k < bucket_start_[bucket + 1]; ++k) {
+    const GridEntry& other = sorted_[k];
+    if (other.cell_x != cell_x || other.cell_y != cell_y) continue;
+    if (later_only && other.index <= entry.index) continue;
+    add_if_overlapping(entry, other);
+  }
+}
+
+void BroadPhase::find_small_pairs() {
+  // Каждое тело проверяет свою ячейку и четыре соседние "вперёд" (восток и
+  // три снизу): пара тел из соседних ячеек находится только из одной из них,
+  // а внутри ячейки условие i < j оставляет одну проверку на пару.
+  for (const GridEntry& entry : sorted_) {
+    scan_cell(entry, entry.cell_x, entry.cell_y, true);
+    scan_cell(entry, entry.cell_x + 1, entry.cell_y, false);
+    scan_cell(entry, entry.cell_x - 1, entry.cell_y + 1, false);
+    scan_cell(entry, entry.cell_x, entry.cell_y + 1, false);
+    scan_cell(entry, entry.cell_x + 1, entry.cell_y + 1, false);
+  }
+}
+
+void BroadPhase::find_large_pairs(const std::vector<CelestialBody>& bodies) {
+  for (size_t a = 0; a < large_bodies_.size(); ++a) {
+    const CelestialBody& body = bodies[large_bodies_[a]];
+    GridEntry entry = {body.x, body.y, body.radius, large_bodies_[a], 0, 0};
+
+    // Крупные тела между собой — перебором, их немного
+    for (size_t b = a + 1; b < large_bodies_.size(); ++b) {
+      const CelestialBody& other = bodies[large_bodies_[b]];
+      add_if_overlapping(
+          entry, {other.x, other.y, other.radius, large_bodies_[b], 0, 0});
+    }
+
+    // Обычные тела — по ячейкам, которые накрывает крупное тело вместе с
+    // радиусом обычного. Каждое тело сетки лежит в одной ячейке, поэтому
+    // пары не повторяются. Если ячеек больше, чем тел, проще перебрать тела.
+    float reach = body.radius + max_small_radius_;
+    int min_x = to_cell(body.x - reach);
+    int max_x = to_cell(body.x + reach);
+    int min_y = to_cell(body.y - reach);
+    int max_y = to_cell(body.y + reach);
+    int64_t cell_count = (static_cast<int64_t>(max_x) - min_x + 1) *
+                         (static_cast<int64_t>(max_y) - min_y + 1);
+    if (cell_count > static_cast<int64_t>(sorted_.size())) {
+      for (const GridEntry& other : sorted_) {
+        add_if_overlapping(entry, other);
+      }
+      continue;
+    }
+    for (int y = min_y; y <= max_y; ++y) {
+      for (int x = min_x; x <= max_x; ++x) {
+        scan_cell(entry, x, y, false);
+      }
+    }
+  }
+}
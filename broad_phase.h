@@ -0,0 +1,69 @@
+#ifndef BROAD_PHASE_H
+#define BROAD_PHASE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "precision.h"
+
+struct CelestialBody;
+
+// Пара пересекающихся тел, индексы в массиве тел, first < second
+struct CollisionPair {
+  int first;
+  int second;
+};
+
+// Поиск столкновений на равномерной сетке. Бесконечная сетка сворачивается в
+// тор из корзин (номера ячеек берутся по модулю размеров таблицы), тела
+// раскладываются по корзинам сортировкой подсчётом, и каждое тело проверяет
+// только соседние ячейки, поэтому шаг стоит O(N). Соседние ячейки попадают в
+// соседние корзины, так что просмотр идёт по памяти почти подряд. Размер ячейки
+// равен наибольшему диаметру обычных тел; тела, которые намного больше
+// среднего, в сетку не кладутся и сами обходят все накрытые ими ячейки.
+//
+// Буферы переиспользуются между шагами, после прогрева память не выделяется.
+class BroadPhase {
+ public:
+  // Находит все пары пересекающихся тел, каждую ровно один раз. В паре first —
+  // тело с меньшим id, пары упорядочены по id first, затем second. Результат
+  // действителен до следующего вызова.
+  const std::vector<CollisionPair>& find_overlapping_pairs(
+      const std::vector<CelestialBody>& bodies);
+  // Пар, проверенных на пересечение при последнем поиске
+  int64_t get_pair_test_count() const { return pair_test_count_; }
+
+ private:
+  float inverse_cell_size_ = 1.0f;
+  float max_small_radius_ = 0.0f;
+  int column_bits_ = 0;
+  uint32_t column_mask_ = 0;
+  uint32_t row_mask_ = 0;
+
+  // Обычное тело в сетке. Координаты скопированы, чтобы просмотр корзины
+  // читал память подряд.
+  struct GridEntry {
+    Real x, y;
+    float radius;
+    int index;  // индекс в массиве тел
+    int cell_x, cell_y;
+  };
+
+  std::vector<GridEntry> entries_;        // в порядке тел
+  std::vector<uint32_t> entry_buckets_;  // корзины entries_
+  std::vector<int> bucket_start_;        // начала корзин в sorted_
+  std::vector<GridEntry> sorted_;        // упорядочены по корзинам
+  std::vector<int> large_bodies_;        // крупные тела вне сетки
+  std::vector<CollisionPair> pairs_;
+  int64_t pair_test_count_ = 0;
+
+  int to_cell(Real coordinate) const;
+  uint32_t cell_bucket(int x, int y) const;
+  void add_if_overlapping(const GridEntry& a, const GridEntry& b);
+  void scan_cell(const GridEntry& entry, int cell_x, int cell_y,
+                 bool later_only);
+  void find_small_pairs();
+  void find_large_pairs(const std::vector<CelestialBody>& bodies);
+};
+
+#endif  // BROAD_PHASE_H
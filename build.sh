@@ -6,4 +6,21 @@ npm run format
 # Format C++ files
 clang-format -i -style=file *.cpp *.h
 
-emcc --bind simulation.cpp renderer.cpp quadtree.cpp -o public/simulation.js -std=c++14 -s FULL_ES3=1 -s MAX_WEBGL_VERSION=2 --preload-file shader.vert --preload-file shader.frag
+# Многопоточная сборка: SOLAR_SIM_THREADS=1 ./build.sh
+# Ей нужен SharedArrayBuffer, то есть заголовки COOP/COEP на сервере (serve.sh
+# их отдаёт). Физика в ней шагает в отдельном потоке, поэтому пул на один поток
+# больше числа ядер.
+THREAD_FLAGS=""
+if [ "$SOLAR_SIM_THREADS" = "1" ]; then
+  THREAD_FLAGS="-pthread -s PTHREAD_POOL_SIZE=navigator.hardwareConcurrency+1"
+fi
+
+# Точность вычислений: SOLAR_SIM_PRECISION=double или mixed ./build.sh
+PRECISION_FLAGS=""
+if [ "$SOLAR_SIM_PRECISION" = "double" ]; then
+  PRECISION_FLAGS="-DSOLAR_SIM_PRECISION_DOUBLE"
+elif [ "$SOLAR_SIM_PRECISION" = "mixed" ]; then
+  PRECISION_FLAGS="-DSOLAR_SIM_PRECISION_MIXED"
+fi
+
+emcc --bind main.cpp simulation.cpp renderer.cpp quadtree.cpp broad_phase.cpp thread_pool.cpp gravity_kernels.cpp fmm.cpp direct_solver.cpp profiler.cpp frame_scheduler.cpp snapshot_buffer.cpp -o public/simulation.js -std=c++17 -O3 -msimd128 -s FULL_ES3=1 -s MAX_WEBGL_VERSION=2 $THREAD_FLAGS $PRECISION_FLAGS --preload-file shader.vert --preload-file shader.frag
@@ -0,0 +1,486 @@
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#ifdef SOLAR_SIM_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "async_writer.h"
+#include "parameter_file.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'O', 'L', 'A', 'R', 'C', 'K', 'P'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kEndianTag = 0x01020304;
+constexpr uint64_t kAlignment = 64;
+
+enum SectionType : uint32_t {
+  SECTION_PARAMETERS = 1,
+  SECTION_RNG,
+  SECTION_ID,
+  SECTION_X,
+  SECTION_Y,
+  SECTION_VX,
+  SECTION_VY,
+  SECTION_MASS,
+  SECTION_RADIUS,
+  SECTION_TIMESTEP_LEVEL,
+};
+
+// Раздел сжат zlib после перестановки байтов по разрядам
+constexpr uint32_t kSectionCompressed = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian_tag;
+  uint32_t real_size;
+  uint32_t section_count;
+  uint64_t body_count;
+  int64_t step_count;
+  uint8_t reserved[24];
+};
+static_assert(sizeof(FileHeader) == 64, "header must stay 64 bytes");
+
+struct SectionEntry {
+  uint32_t type;
+  uint32_t element_size;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t stored_size;
+  uint64_t raw_size;
+};
+static_assert(sizeof(SectionEntry) == 40, "section entry must stay 40 bytes");
+
+// Раздел, подготовленный к записи
+struct Section {
+  uint32_t type;
+  uint32_t element_size;
+  uint32_t flags;
+  uint64_t raw_size;
+  std::vector<char> data;
+};
+
+// Состояние, скопированное для записи
+struct CheckpointData {
+  FileHeader header;
+  std::vector<Section> sections;
+
+  size_t byte_count() const {
+    size_t bytes = sizeof(header);
+    for (const Section& section : sections) bytes += section.data.size();
+    return bytes;
+  }
+};
+
+uint64_t align(uint64_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+Section make_text_section(uint32_t type, const std::string& text) {
+  return {type, 1, 0, text.size(), std::vector<char>(text.begin(), text.end())};
+}
+
+template <typename T, typename Field>
+Section make_column(uint32_t type, const std::vector<CelestialBody>& bodies,
+                    Field field) {
+  Section section = {type, sizeof(T), 0, bodies.size() * sizeof(T), {}};
+  section.data.resize(section.raw_size);
+  char* out = section.data.data();
+  for (const CelestialBody& body : bodies) {
+    const T value = field(body);
+    std::memcpy(out, &value, sizeof(T));
+    out += sizeof(T);
+  }
+  return section;
+}
+
+std::shared_ptr<CheckpointData> capture(
+    const std::vector<CelestialBody>& bodies,
+    const SimulationParameters& params,
+    const SimulationWorkspace& workspace) {
+  auto data = std::make_shared<CheckpointData>();
+  FileHeader& header = data->header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.endian_tag = kEndianTag;
+  header.real_size = sizeof(Real);
+  header.body_count = bodies.size();
+  header.step_count = workspace.step_count;
+
+  std::ostringstream rng_state;
+  rng_state << workspace.rng;
+  std::vector<Section>& sections = data->sections;
+  sections.push_back(
+      make_text_section(SECTION_PARAMETERS, format_parameters(params)));
+  sections.push_back(make_text_section(SECTION_RNG, rng_state.str()));
+  sections.push_back(make_column<int32_t>(
+      SECTION_ID, bodies, [](const CelestialBody& b) { return b.id; }));
+  sections.push_back(make_column<Real>(
+      SECTION_X, bodies, [](const CelestialBody& b) { return b.x; }));
+  sections.push_back(make_column<Real>(
+      SECTION_Y, bodies, [](const CelestialBody& b) { return b.y; }));
+  sections.push_back(make_column<Real>(
+      SECTION_VX, bodies, [](const CelestialBody& b) { return b.vx; }));
+  sections.push_back(make_column<Real>(
+      SECTION_VY, bodies, [](const CelestialBody& b) { return b.vy; }));
+  sections.push_back(make_column<float>(
+      SECTION_MASS, bodies, [](const CelestialBody& b) { return b.mass; }));
+  sections.push_back(make_column<float>(
+      SECTION_RADIUS, bodies, [](const CelestialBody& b) { return b.radius; }));
+  sections.push_back(make_column<uint8_t>(
+      SECTION_TIMESTEP_LEVEL, bodies,
+      [](const CelestialBody& b) { return b.timestep_level; }));
+  header.section_count = static_cast<uint32_t>(sections.size());
+  return data;
+}
+
+#ifdef SOLAR_SIM_HAVE_ZLIB
+// Перестановка байтов: сначала младшие байты всех элементов, затем следующие.
+// Старшие байты соседних чисел похожи, и zlib сжимает их лучше.
+void shuffle_bytes(const char* in, size_t size, uint32_t element_size,
+                   char* out) {
+  const size_t count = size / element_size;
+  for (size_t i = 0; i < count; ++i) {
+    for (uint32_t b = 0; b < element_size; ++b) {
+      out[b * count + i] = in[i * element_size + b];
+    }
+  }
+}
+
+void unshuffle_bytes(const char* in, size_t size, uint32_t element_size,
+                     char* out) {
+  const size_t count = size / element_size;
+  for (size_t i = 0; i < count; ++i) {
+    for (uint32_t b = 0; b < element_size; ++b) {
+      out[i * element_size + b] = in[b * count + i];
+    }
+  }
+}
+
+// Сжимает раздел, если это уменьшает его
+void compress_section(Section& section) {
+  std::vector<char> shuffled(section.data.size());
+  shuffle_bytes(section.data.data(), section.data.size(), section.element_size,
+                shuffled.data());
+  uLongf compressed_size = compressBound(shuffled.size());
+  std::vector<char> compressed(compressed_size);
+  if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size,
+                reinterpret_cast<const Bytef*>(shuffled.data()),
+                shuffled.size(), Z_BEST_SPEED) != Z_OK ||
+      compressed_size >= section.data.size()) {
+    return;
+  }
+  compressed.resize(compressed_size);
+  section.data.swap(compressed);
+  section.flags |= kSectionCompressed;
+}
+#endif
+
+bool write_checkpoint(const std::string& path, CheckpointData& data,
+                      bool compress) {
+#ifdef SOLAR_SIM_HAVE_ZLIB
+  if (compress) {
+    for (Section& section : data.sections) {
+      compress_section(section);
+    }
+  }
+#else
+  if (compress) {
+    std::cerr << "Checkpoint compression needs a build with zlib, writing "
+              << path << " uncompressed" << std::endl;
+  }
+#endif
+
+  std::vector<SectionEntry> entries;
+  uint64_t offset = align(sizeof(FileHeader) +
+                          data.sections.size() * sizeof(SectionEntry));
+  for (const Section& section : data.sections) {
+    entries.push_back({section.type, section.element_size, section.flags, 0,
+                       offset, section.data.size(), section.raw_size});
+    offset = align(offset + section.data.size());
+  }
+
+  const std::string temp_path = path + ".tmp";
+  std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Failed to create checkpoint: " << temp_path << std::endl;
+    return false;
+  }
+  const char padding[kAlignment] = {};
+  uint64_t position = 0;
+  auto write = [&](const void* bytes, size_t size) {
+    position += size;
+    return std::fwrite(bytes, 1, size, file) == size;
+  };
+  bool ok = write(&data.header, sizeof(data.header)) &&
+            write(entries.data(), entries.size() * sizeof(SectionEntry));
+  for (size_t i = 0; ok && i < data.sections.size(); ++i) {
+    ok = write(padding, entries[i].offset - position) &&
+         write(data.sections[i].data.data(), data.sections[i].data.size());
+  }
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "Failed to write checkpoint: " << path << std::endl;
+    std::remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Файл, отображённый в память только для чтения
+class MappedFile {
+ public:
+  ~MappedFile() {
+    if (data_ != MAP_FAILED) munmap(data_, size_);
+    if (fd_ >= 0) close(fd_);
+  }
+
+  bool open(const std::string& path) {
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd_ < 0 || fstat(fd_, &file_stat) != 0 || file_stat.st_size == 0) {
+      return false;
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    return data_ != MAP_FAILED;
+  }
+
+  const char* data() const { return static_cast<const char*>(data_); }
+  size_t size() const { return size_; }
+
+ private:
+  int fd_ = -1;
+  void* data_ = MAP_FAILED;
+  size_t size_ = 0;
+};
+
+// Байты раздела: прямо из отображения или распакованные в storage
+const char* section_bytes(const MappedFile& file, const SectionEntry& entry,
+                          std::vector<char>& storage) {
+  if (entry.offset > file.size() ||
+      entry.stored_size > file.size() - entry.offset) {
+    return nullptr;
+  }
+  const char* stored = file.data() + entry.offset;
+  if ((entry.flags & kSectionCompressed) == 0) {
+    return entry.stored_size == entry.raw_size ? stored : nullptr;
+  }
+#ifdef SOLAR_SIM_HAVE_ZLIB
+  if (entry.element_size == 0) {
+    return nullptr;
+  }
+  std::vector<char> shuffled(entry.raw_size);
+  uLongf raw_size = entry.raw_size;
+  if (uncompress(reinterpret_cast<Bytef*>(shuffled.data()), &raw_size,
+                 reinterpret_cast<const Bytef*>(stored),
+                 entry.stored_size) != Z_OK ||
+      raw_size != entry.raw_size) {
+    return nullptr;
+  }
+  storage.resize(entry.raw_size);
+  unshuffle_bytes(shuffled.data(), shuffled.size(), entry.element_size,
+                  storage.data());
+  return storage.data();
+#else
+  std::cerr << "Checkpoint is compressed, but the build has no zlib"
+            << std::endl;
+  return nullptr;
+#endif
+}
+
+// Размер элемента раздела: 1 для текста, real_size для столбцов Real
+uint32_t expected_element_size(uint32_t type, uint32_t real_size) {
+  switch (type) {
+    case SECTION_X:
+    case SECTION_Y:
+    case SECTION_VX:
+    case SECTION_VY:
+      return real_size;
+    case SECTION_ID:
+    case SECTION_MASS:
+    case SECTION_RADIUS:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
+template <typename T>
+T read_element(const char* column, size_t index) {
+  T value;
+  std::memcpy(&value, column + index * sizeof(T), sizeof(T));
+  return value;
+}
+
+// Элемент столбца Real, записанного с размером real_size
+Real read_real(const char* column, size_t index, uint32_t real_size) {
+  if (real_size == sizeof(double)) {
+    return static_cast<Real>(read_element<double>(column, index));
+  }
+  return static_cast<Real>(read_element<float>(column, index));
+}
+
+}  // namespace
+
+void save_checkpoint_async(const std::string& path,
+                           const std::vector<CelestialBody>& bodies,
+                           const SimulationParameters& params,
+                           const SimulationWorkspace& workspace, bool compress,
+                           AsyncWriter& writer) {
+  std::shared_ptr<CheckpointData> data = capture(bodies, params, workspace);
+  const size_t bytes = data->byte_count();
+  writer.submit([path, data, compress] {
+    write_checkpoint(path, *data, compress);
+  }, bytes);
+}
+
+bool save_checkpoint(const std::string& path,
+                     const std::vector<CelestialBody>& bodies,
+                     const SimulationParameters& params,
+                     const SimulationWorkspace& workspace, bool compress) {
+  return write_checkpoint(path, *capture(bodies, params, workspace), compress);
+}
+
+bool is_checkpoint_file(const std::string& path) {
+  char magic[sizeof(kMagic)] = {};
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  const bool ok = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic);
+  std::fclose(file);
+  return ok && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool load_checkpoint(const std::string& path,
+                     std::vector<CelestialBody>& bodies,
+                     SimulationParameters& params,
+                     SimulationWorkspace& workspace) {
+  MappedFile file;
+  if (!file.open(path)) {
+    std::cerr << "Failed to open checkpoint: " << path << std::endl;
+    return false;
+  }
+  FileHeader header;
+  if (file.size() < sizeof(header)) {
+    std::cerr << "Checkpoint is truncated: " << path << std::endl;
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.endian_tag != kEndianTag) {
+    std::cerr << "Not a checkpoint of this platform: " << path << std::endl;
+    return false;
+  }
+  if (header.version != kVersion) {
+    std::cerr << "Unsupported checkpoint version " << header.version << ": "
+              << path << std::endl;
+    return false;
+  }
+  if ((header.real_size != sizeof(float) &&
+       header.real_size != sizeof(double)) ||
+      header.section_count >
+          (file.size() - sizeof(header)) / sizeof(SectionEntry)) {
+    std::cerr << "Checkpoint is corrupted: " << path << std::endl;
+    return false;
+  }
+
+  // Разделы по типам; неизвестные типы пропускаются
+  const size_t body_count = header.body_count;
+  const char* columns[SECTION_TIMESTEP_LEVEL + 1] = {};
+  std::vector<char> storage[SECTION_TIMESTEP_LEVEL + 1];
+  for (uint32_t i = 0; i < header.section_count; ++i) {
+    SectionEntry entry;
+    std::memcpy(&entry,
+                file.data() + sizeof(header) + i * sizeof(SectionEntry),
+                sizeof(entry));
+    if (entry.type < SECTION_PARAMETERS ||
+        entry.type > SECTION_TIMESTEP_LEVEL) {
+      continue;
+    }
+    const bool is_text =
+        entry.type == SECTION_PARAMETERS || entry.type == SECTION_RNG;
+    // Размер элемента проверяется до распаковки: по нему переставляются байты
+    // и читаются столбцы
+    const char* bytes =
+        entry.element_size ==
+                expected_element_size(entry.type, header.real_size)
+            ? section_bytes(file, entry, storage[entry.type])
+            : nullptr;
+    if (!bytes ||
+        (!is_text && entry.raw_size != body_count * entry.element_size)) {
+      std::cerr << "Checkpoint section " << entry.type
+                << " is corrupted: " << path << std::endl;
+      return false;
+    }
+    if (is_text) {
+      // Текст копируется с завершающим нулём для istringstream
+      std::vector<char>& text = storage[entry.type];
+      if (bytes != text.data()) {
+        text.assign(bytes, bytes + entry.raw_size);
+      }
+      text.push_back('\0');
+      bytes = text.data();
+    }
+    columns[entry.type] = bytes;
+  }
+  for (uint32_t type = SECTION_PARAMETERS; type <= SECTION_TIMESTEP_LEVEL;
+       ++type) {
+    if (!columns[type]) {
+      std::cerr << "Checkpoint section " << type << " is missing: " << path
+                << std::endl;
+      return false;
+    }
+  }
+
+  SimulationParameters loaded_params;
+  std::istringstream parameter_text(storage[SECTION_PARAMETERS].data());
+  if (!read_parameters(parameter_text, path, loaded_params)) {
+    return false;
+  }
+  std::istringstream rng_state(storage[SECTION_RNG].data());
+  std::mt19937 rng;
+  if (!(rng_state >> rng)) {
+    std::cerr << "Checkpoint RNG state is corrupted: " << path << std::endl;
+    return false;
+  }
+
+  const uint32_t real_size = header.real_size;
+  bodies.resize(body_count);
+  for (size_t i = 0; i < body_count; ++i) {
+    CelestialBody& body = bodies[i];
+    body = CelestialBody();
+    body.id = read_element<int32_t>(columns[SECTION_ID], i);
+    body.x = read_real(columns[SECTION_X], i, real_size);
+    body.y = read_real(columns[SECTION_Y], i, real_size);
+    body.vx = read_real(columns[SECTION_VX], i, real_size);
+    body.vy = read_real(columns[SECTION_VY], i, real_size);
+    body.mass = read_element<float>(columns[SECTION_MASS], i);
+    body.radius = read_element<float>(columns[SECTION_RADIUS], i);
+    body.timestep_level =
+        read_element<uint8_t>(columns[SECTION_TIMESTEP_LEVEL], i);
+  }
+
+  params = loaded_params;
+  workspace.rng = rng;
+  workspace.step_count = header.step_count;
+  workspace.accelerations_valid = false;
+  workspace.tree_refit_count = 0;
+  return true;
+}
@@ -0,0 +1,48 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+class AsyncWriter;
+
+// Двоичная контрольная точка для перезапуска долгих прогонов. Файл:
+//   заголовок (64 байта): "SOLARCKP", версия, метка порядка байтов, размер
+//     Real, число тел, число шагов, число разделов;
+//   таблица разделов: тип, размер элемента, флаги, смещение, размер
+//     в файле и исходный размер;
+//   разделы, каждый с границы 64 байт: параметры в формате файла
+//     параметров, состояние генератора, столбцы тел (id, x, y, vx, vy, масса,
+//     радиус, уровень шага).
+// Столбцы можно сжать (zlib с перестановкой байтов по разрядам), если сборка
+// с zlib. Несжатые столбцы читаются прямо из отображённого в память файла.
+// Файл пишется под временным именем и переименовывается после записи, поэтому
+// прерванная запись не портит прежнюю точку.
+
+// Копирует состояние и ставит запись файла в очередь writer. Шаги ждут только
+// копирования, а сжатие и запись идут в потоке writer.
+void save_checkpoint_async(const std::string& path,
+                           const std::vector<CelestialBody>& bodies,
+                           const SimulationParameters& params,
+                           const SimulationWorkspace& workspace, bool compress,
+                           AsyncWriter& writer);
+// Записывает контрольную точку сразу
+bool save_checkpoint(const std::string& path,
+                     const std::vector<CelestialBody>& bodies,
+                     const SimulationParameters& params,
+                     const SimulationWorkspace& workspace, bool compress);
+
+// Файл начинается с сигнатуры контрольной точки
+bool is_checkpoint_file(const std::string& path);
+// Загружает контрольную точку, отображая файл в память. Восстанавливает тела,
+// параметры, счётчик шагов и генератор; ускорения будут вычислены заново.
+// Точка, записанная с другим размером Real, преобразуется. Об ошибках
+// сообщает в std::cerr и возвращает false.
+bool load_checkpoint(const std::string& path,
+                     std::vector<CelestialBody>& bodies,
+                     SimulationParameters& params,
+                     SimulationWorkspace& workspace);
+
+#endif  // CHECKPOINT_H
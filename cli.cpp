@@ -0,0 +1,177 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "async_writer.h"
+#include "checkpoint.h"
+#include "parameter_file.h"
+#include "profiler.h"
+#include "quadtree.h"
+#include "simulation.h"
+#include "trajectory.h"
+
+namespace {
+
+void print_usage(const char* program) {
+  std::cerr << "Usage: " << program
+            << " <parameter file | checkpoint> [steps] [profile.json]"
+               " [--checkpoint PATH] [--checkpoint-every N] [--compress]"
+               " [--trajectory PATH] [--trajectory-every N]"
+               " [--trajectory-quantum Q]"
+            << std::endl;
+}
+
+}  // namespace
+
+// Запуск симуляции без графики:
+//   solar_sim_cli <файл параметров | контрольная точка> [количество шагов]
+//                 [файл профиля] [--checkpoint PATH] [--checkpoint-every N]
+//                 [--compress] [--trajectory PATH] [--trajectory-every N]
+//                 [--trajectory-quantum Q]
+// Файл профиля получает статистику последних шагов в JSON. С --checkpoint
+// состояние сохраняется в PATH каждые N шагов (если задано) и в конце прогона;
+// запуск с файлом контрольной точки продолжает сохранённый прогон.
+// С --trajectory в PATH пишутся кадры траекторий раз в N шагов (по умолчанию
+// 10) с положениями, квантованными с шагом Q (по умолчанию 0.001).
+int main(int argc, char* argv[]) {
+  std::vector<const char*> positional;
+  std::string checkpoint_path;
+  int checkpoint_every = 0;
+  bool compress = false;
+  std::string trajectory_path;
+  int trajectory_every = 10;
+  double trajectory_quantum = 0.001;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpoint_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--checkpoint-every") == 0 &&
+               i + 1 < argc) {
+      checkpoint_every = std::atoi(argv[++i]);
+      if (checkpoint_every <= 0) {
+        std::cerr << "Invalid checkpoint interval: " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (std::strcmp(argv[i], "--compress") == 0) {
+      compress = true;
+    } else if (std::strcmp(argv[i], "--trajectory") == 0 && i + 1 < argc) {
+      trajectory_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--trajectory-every") == 0 &&
+               i + 1 < argc) {
+      trajectory_every = std::atoi(argv[++i]);
+      if (trajectory_every <= 0) {
+        std::cerr << "Invalid trajectory interval: " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (std::strcmp(argv[i], "--trajectory-quantum") == 0 &&
+               i + 1 < argc) {
+      trajectory_quantum = std::atof(argv[++i]);
+      if (!(trajectory_quantum > 0.0)) {
+        std::cerr << "Invalid trajectory quantum: " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (std::strncmp(argv[i], "--", 2) == 0) {
+      print_usage(argv[0]);
+      return 1;
+    } else {
+      positional.push_back(argv[i]);
+    }
+  }
+  if (positional.empty() || positional.size() > 3) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  SimulationParameters params;
+  std::vector<CelestialBody> bodies;
+  SimulationWorkspace workspace;
+  if (is_checkpoint_file(positional[0])) {
+    if (!load_checkpoint(positional[0], bodies, params, workspace)) {
+      return 1;
+    }
+  } else {
+    if (!load_parameter_file(positional[0], params)) {
+      return 1;
+    }
+    workspace.rng.seed(get_random_seed(params));
+    initialize_bodies(bodies, params, workspace.rng);
+  }
+  int steps = 1000;
+  if (positional.size() >= 2) {
+    steps = std::atoi(positional[1]);
+    if (steps <= 0) {
+      std::cerr << "Invalid step count: " << positional[1] << std::endl;
+      return 1;
+    }
+  }
+
+  Boundary boundary = {0.0f, 0.0f, params.INITIALIZATION_RADIUS * 2.0f};
+  Quadtree qtree(boundary, 4);
+  const int64_t first_step = workspace.step_count;
+  AsyncWriter writer;
+  // Отдельная очередь, чтобы запись контрольной точки не вытесняла кадры
+  AsyncWriter trajectory_queue(64u << 20);
+  TrajectoryWriter trajectory(trajectory_queue, trajectory_quantum,
+                              trajectory_every);
+  if (!trajectory_path.empty() && !trajectory.open(trajectory_path)) {
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < steps; ++i) {
+    update_simulation(bodies, qtree, params, workspace);
+    if (!trajectory_path.empty()) {
+      trajectory.record(bodies, workspace);
+    }
+    if (!checkpoint_path.empty() && checkpoint_every > 0 && i + 1 < steps &&
+        (i + 1) % checkpoint_every == 0) {
+      save_checkpoint_async(checkpoint_path, bodies, params, workspace,
+                            compress, writer);
+    }
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  std::printf("steps %d (%lld -> %lld), bodies %d -> %zu, threads %d\n",
+              steps, static_cast<long long>(first_step),
+              static_cast<long long>(workspace.step_count), params.NUM_BODIES,
+              bodies.size(), workspace.pool.get_num_threads());
+  std::printf("total %.3f s, %.3f ms/step\n", seconds,
+              seconds * 1e3 / steps);
+  std::printf("state hash %016llx\n",
+              static_cast<unsigned long long>(hash_bodies(bodies)));
+  const PhaseTimes& times = workspace.phase_times;
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    std::printf("  %-10s %12.3f ms/step\n", get_phase_name(phase),
+                times.nanoseconds[phase] * 1e-6 / times.step_count);
+  }
+
+  if (!trajectory_path.empty()) {
+    trajectory_queue.flush();
+    std::printf("trajectory frames %lld written, %lld dropped\n",
+                static_cast<long long>(trajectory.get_written_frames()),
+                static_cast<long long>(trajectory.get_dropped_frames()));
+  }
+  if (!checkpoint_path.empty()) {
+    writer.flush();
+    if (!save_checkpoint(checkpoint_path, bodies, params, workspace,
+                         compress)) {
+      return 1;
+    }
+  }
+
+  if (positional.size() == 3) {
+    std::ofstream profile_file(positional[2]);
+    if (!profile_file) {
+      std::cerr << "Could not write profile: " << positional[2] << std::endl;
+      return 1;
+    }
+    profile_file << workspace.profile.to_json() << std::endl;
+  }
+  return 0;
+}
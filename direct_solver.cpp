@@ -0,0 +1,93 @@
+#include "direct_solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "gravity_kernels.h"
+#include "simulation.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Цели раздаются потокам блоками по kTargetChunk тел, а источники
+// перебираются блоками по kSourceBlock: три массива блока (24 КБ во float)
+// остаются в кэше, пока по ним проходят все цели блока
+constexpr int kTargetChunk = 64;
+constexpr int kSourceBlock = 2048;
+
+}  // namespace
+
+void DirectSolver::copy_sources(const std::vector<CelestialBody>& bodies) {
+  const size_t count = bodies.size();
+  x_.resize(count);
+  y_.resize(count);
+  mass_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    x_[i] = static_cast<KernelReal>(bodies[i].x);
+    y_[i] = static_cast<KernelReal>(bodies[i].y);
+    mass_[i] = bodies[i].mass;
+  }
+}
+
+void DirectSolver::calculate_forces(std::vector<CelestialBody>& bodies,
+                                    ThreadPool& pool, float G,
+                                    float softening_factor, int active_level) {
+  copy_sources(bodies);
+  const int count = static_cast<int>(bodies.size());
+  const KernelReal softening_sq = softening_factor * softening_factor;
+  pool.parallel_for(count, kTargetChunk, [&](int begin, int end) {
+    double sum_x[kTargetChunk] = {};
+    double sum_y[kTargetChunk] = {};
+    for (int block = 0; block < count; block += kSourceBlock) {
+      const int block_size = std::min(kSourceBlock, count - block);
+      for (int i = begin; i < end; ++i) {
+        if (bodies[i].timestep_level < active_level) continue;
+        KernelReal ax = 0.0f;
+        KernelReal ay = 0.0f;
+        accumulate_acceleration(x_[i], y_[i], &x_[block], &y_[block],
+                                &mass_[block], block_size, softening_sq, ax,
+                                ay);
+        sum_x[i - begin] += ax;
+        sum_y[i - begin] += ay;
+      }
+    }
+    for (int i = begin; i < end; ++i) {
+      if (bodies[i].timestep_level < active_level) continue;
+      bodies[i].ax += static_cast<Real>(G * sum_x[i - begin]);
+      bodies[i].ay += static_cast<Real>(G * sum_y[i - begin]);
+    }
+  });
+}
+
+double DirectSolver::calculate_potential_energy(
+    const std::vector<CelestialBody>& bodies, ThreadPool& pool, float G,
+    float softening_factor) {
+  const int count = static_cast<int>(bodies.size());
+  const double softening_sq =
+      static_cast<double>(softening_factor) * softening_factor;
+  // Каждая пара входит дважды, по разу для каждой цели. Суммы блоков целей
+  // складываются по порядку, поэтому результат не зависит от числа потоков.
+  chunk_energy_.assign((count + kTargetChunk - 1) / kTargetChunk, 0.0);
+  pool.parallel_for(count, kTargetChunk, [&](int begin, int end) {
+    double energy = 0.0;
+    for (int i = begin; i < end; ++i) {
+      const double x = bodies[i].x;
+      const double y = bodies[i].y;
+      double potential = 0.0;
+      for (int j = 0; j < count; ++j) {
+        if (j == i) continue;
+        const double dx = bodies[j].x - x;
+        const double dy = bodies[j].y - y;
+        potential +=
+            bodies[j].mass / std::sqrt(dx * dx + dy * dy + softening_sq);
+      }
+      energy += bodies[i].mass * potential;
+    }
+    chunk_energy_[begin / kTargetChunk] = energy;
+  });
+  double energy = 0.0;
+  for (double chunk : chunk_energy_) {
+    energy += chunk;
+  }
+  return -0.5 * G * energy;
+}
@@ -0,0 +1,37 @@
+#ifndef DIRECT_SOLVER_H
+#define DIRECT_SOLVER_H
+
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "precision.h"
+
+struct CelestialBody;
+class ThreadPool;
+
+// Прямое суммирование гравитации всех пар, O(N^2). Служит эталоном точности
+// для дерева: смягчение то же, что в Quadtree::calculate_force (ядра
+// gravity_kernels), а источники перебираются блоками, которые помещаются в
+// кэш. Суммы по блокам складываются в double, поэтому ошибка округления
+// эталона много меньше ошибки приближений дерева.
+class DirectSolver {
+ public:
+  // Добавляет ускорения телам с уровнем блочного шага не меньше active_level
+  void calculate_forces(std::vector<CelestialBody>& bodies, ThreadPool& pool,
+                        float G, float softening_factor, int active_level);
+  // Смягчённая потенциальная энергия всех пар в double:
+  // -G * sum m_i m_j / sqrt(|d|^2 + eps^2)
+  double calculate_potential_energy(const std::vector<CelestialBody>& bodies,
+                                    ThreadPool& pool, float G,
+                                    float softening_factor);
+
+ private:
+  AlignedVector<KernelReal> x_;
+  AlignedVector<KernelReal> y_;
+  AlignedVector<KernelReal> mass_;
+  std::vector<double> chunk_energy_;  // по блокам целей, без атомиков
+
+  void copy_sources(const std::vector<CelestialBody>& bodies);
+};
+
+#endif  // DIRECT_SOLVER_H
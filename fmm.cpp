@@ -0,0 +1,351 @@
+#include "fmm.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "gravity_kernels.h"
+#include "quadtree.h"
+#include "simulation.h"
+#include "thread_pool.h"
+
+namespace {
+
+constexpr int kMaxCoefficients = (kMaxFmmOrder + 1) * (kMaxFmmOrder + 2) / 2;
+
+// Узлы с таким числом тел считаются листьями: тела поддерева лежат подряд,
+// и попарное взаимодействие таких блоков хорошо векторизуется
+constexpr int kLeafSize = 32;
+// Задач в воспроизводимом режиме, с запасом на 8 потоков
+constexpr int kDeterministicTaskCount = 64;
+
+// Коэффициенты разложений хранятся по возрастанию полной степени i + j
+inline int coefficient_index(int i, int j) {
+  int degree = i + j;
+  return degree * (degree + 1) / 2 + j;
+}
+
+// out[(i, j)] = x^i / i! * y^j / j! для i + j <= order
+void scaled_powers(double x, double y, int order, double* out) {
+  double power_x[kMaxFmmOrder + 1];
+  double power_y[kMaxFmmOrder + 1];
+  power_x[0] = 1.0;
+  power_y[0] = 1.0;
+  for (int i = 1; i <= order; ++i) {
+    power_x[i] = power_x[i - 1] * x / i;
+    power_y[i] = power_y[i - 1] * y / i;
+  }
+  for (int degree = 0; degree <= order; ++degree) {
+    for (int j = 0; j <= degree; ++j) {
+      out[coefficient_index(degree - j, j)] = power_x[degree - j] * power_y[j];
+    }
+  }
+}
+
+// Частные производные D(i, j) смягчённого потенциала
+// phi(x, y) = (x^2 + y^2 + eps^2)^(-1/2) до порядка order. Из тождества
+// s * phi_x = -x * phi, s = x^2 + y^2 + eps^2, дифференцированием получается
+// s * D(i, j) = -(2i - 1) x D(i-1, j) - (i - 1)^2 D(i-2, j)
+//               - 2j y D(i, j-1) - j (j - 1) D(i, j-2),
+// и симметрично по y для i = 0
+void potential_derivatives(double x, double y, double softening_sq, int order,
+                           double* out) {
+  double inv_s = 1.0 / (x * x + y * y + softening_sq);
+  out[0] = std::sqrt(inv_s);
+  for (int degree = 1; degree <= order; ++degree) {
+    for (int j = 0; j <= degree; ++j) {
+      int i = degree - j;
+      double sum = 0.0;
+      if (i > 0) {
+        sum -= (2 * i - 1) * x * out[coefficient_index(i - 1, j)];
+        if (i > 1) sum -= (i - 1) * (i - 1) * out[coefficient_index(i - 2, j)];
+        if (j > 0) sum -= 2 * j * y * out[coefficient_index(i, j - 1)];
+        if (j > 1) sum -= j * (j - 1) * out[coefficient_index(i, j - 2)];
+      } else {
+        sum -= (2 * j - 1) * y * out[coefficient_index(0, j - 1)];
+        if (j > 1) sum -= (j - 1) * (j - 1) * out[coefficient_index(0, j - 2)];
+      }
+      out[coefficient_index(i, j)] = sum * inv_s;
+    }
+  }
+}
+
+}  // namespace
+
+void FmmSolver::calculate_forces(Quadtree& tree, ThreadPool& pool, int order,
+                                 float theta, float G, float softening_factor,
+                                 bool deterministic) {
+  if (!tree.leaf_bodies_only_) {
+    tree.calculate_forces(pool, theta, G, softening_factor);
+    return;
+  }
+
+  order_ = std::min(std::max(order, 1), kMaxFmmOrder);
+  coefficient_count_ = (order_ + 1) * (order_ + 2) / 2;
+  theta_ = theta;
+  G_ = G;
+  softening_sq_ = softening_factor * softening_factor;
+
+  // 1. Восходящий проход: мультиполи листьев и их сдвиг в родителей
+  const size_t node_count = tree.nodes_.size();
+  multipoles_.assign(node_count * coefficient_count_, 0.0);
+  locals_.assign(node_count * coefficient_count_, 0.0);
+  radii_.assign(node_count, 0.0);
+  subtree_first_body_.assign(node_count, 0);
+  compute_multipoles(tree, 0);
+
+  // 2. Поддеревья-цели обрабатываются независимо: взаимодействия и спуск
+  // локальных разложений меняют только узлы и тела своего поддерева
+  collect_tasks(tree, deterministic ? kDeterministicTaskCount
+                                    : pool.get_num_threads() * 8);
+  pool.parallel_for(static_cast<int>(tasks_.size()), 1,
+                    [&](int begin, int end) {
+                      for (int i = begin; i < end; ++i) {
+                        interact(tree, tasks_[i], 0);
+                        evaluate_locals(tree, tasks_[i]);
+                      }
+                    });
+}
+
+bool FmmSolver::is_leaf(const Quadtree& tree, int node_index) const {
+  const QuadtreeNode& node = tree.nodes_[node_index];
+  return node.first_child < 0 || node.subtree_body_count <= kLeafSize;
+}
+
+void FmmSolver::compute_multipoles(const Quadtree& tree, int node_index) {
+  const QuadtreeNode& node = tree.nodes_[node_index];
+  // build() отдаёт первому потомку начало диапазона родителя
+  int first_body = node.first_body;
+  if (node.first_child >= 0) {
+    const QuadtreeNode* first_leaf = &tree.nodes_[node.first_child];
+    while (first_leaf->first_child >= 0) {
+      first_leaf = &tree.nodes_[first_leaf->first_child];
+    }
+    first_body = first_leaf->first_body;
+  }
+  subtree_first_body_[node_index] = first_body;
+  if (node.total_mass == 0.0f) {
+    return;
+  }
+
+  double* multipole = &multipoles_[node_index * coefficient_count_];
+  double center_x = node.center_of_mass_x;
+  double center_y = node.center_of_mass_y;
+  double radius = 0.0;
+  double powers[kMaxCoefficients];
+
+  if (is_leaf(tree, node_index)) {
+    // P2M: мультиполь листа прямо из тел поддерева
+    for (int i = first_body; i < first_body + node.subtree_body_count; ++i) {
+      double dx = tree.body_x_[i] - center_x;
+      double dy = tree.body_y_[i] - center_y;
+      scaled_powers(dx, dy, order_, powers);
+      for (int k = 0; k < coefficient_count_; ++k) {
+        multipole[k] += tree.body_mass_[i] * powers[k];
+      }
+      radius = std::max(radius, std::sqrt(dx * dx + dy * dy));
+    }
+    radii_[node_index] = radius;
+    return;
+  }
+
+  for (int child_index = node.first_child; child_index < node.first_child + 4;
+       ++child_index) {
+    compute_multipoles(tree, child_index);
+    const QuadtreeNode& child = tree.nodes_[child_index];
+    if (child.total_mass == 0.0f) {
+      continue;
+    }
+    double tx = child.center_of_mass_x - center_x;
+    double ty = child.center_of_mass_y - center_y;
+    scaled_powers(tx, ty, order_, powers);
+    const double* child_multipole =
+        &multipoles_[child_index * coefficient_count_];
+    // M2M: M(i, j) += sum Mc(k, l) * t^(i-k, j-l) / (i-k, j-l)!
+    for (int degree = 0; degree <= order_; ++degree) {
+      for (int j = 0; j <= degree; ++j) {
+        int i = degree - j;
+        double sum = 0.0;
+        for (int k = 0; k <= i; ++k) {
+          for (int l = 0; l <= j; ++l) {
+            sum += child_multipole[coefficient_index(k, l)] *
+                   powers[coefficient_index(i - k, j - l)];
+          }
+        }
+        multipole[coefficient_index(i, j)] += sum;
+      }
+    }
+    radius =
+        std::max(radius, std::sqrt(tx * tx + ty * ty) + radii_[child_index]);
+  }
+  radii_[node_index] = radius;
+}
+
+void FmmSolver::collect_tasks(const Quadtree& tree, int task_count) {
+  const std::vector<QuadtreeNode>& nodes = tree.nodes_;
+  tasks_.assign(1, 0);
+  bool expanded = true;
+  while (expanded && static_cast<int>(tasks_.size()) < task_count) {
+    expanded = false;
+    frontier_.clear();
+    for (int index : tasks_) {
+      const QuadtreeNode& node = nodes[index];
+      if (is_leaf(tree, index)) {
+        frontier_.push_back(index);
+        continue;
+      }
+      for (int child = node.first_child; child < node.first_child + 4;
+           ++child) {
+        if (nodes[child].total_mass > 0.0f) {
+          frontier_.push_back(child);
+        }
+      }
+      expanded = true;
+    }
+    tasks_.swap(frontier_);
+  }
+}
+
+void FmmSolver::interact(const Quadtree& tree, int target, int source) {
+  const QuadtreeNode& target_node = tree.nodes_[target];
+  const QuadtreeNode& source_node = tree.nodes_[source];
+  if (target_node.total_mass == 0.0f || source_node.total_mass == 0.0f) {
+    return;
+  }
+
+  double dx = source_node.center_of_mass_x - target_node.center_of_mass_x;
+  double dy = source_node.center_of_mass_y - target_node.center_of_mass_y;
+  double radii = radii_[target] + radii_[source];
+  if (radii * radii < theta_ * theta_ * (dx * dx + dy * dy)) {
+    multipole_to_local(tree, target, source);
+    return;
+  }
+
+  bool target_leaf = is_leaf(tree, target);
+  bool source_leaf = is_leaf(tree, source);
+  if (target_leaf && source_leaf) {
+    particle_to_particle(tree, target, source);
+    return;
+  }
+
+  // Раскрываем больший из узлов
+  if (target_leaf || (!source_leaf && radii_[source] >= radii_[target])) {
+    for (int i = 0; i < 4; ++i) {
+      interact(tree, target, source_node.first_child + i);
+    }
+  } else {
+    for (int i = 0; i < 4; ++i) {
+      interact(tree, target_node.first_child + i, source);
+    }
+  }
+}
+
+void FmmSolver::multipole_to_local(const Quadtree& tree, int target,
+                                   int source) {
+  const QuadtreeNode& target_node = tree.nodes_[target];
+  const QuadtreeNode& source_node = tree.nodes_[source];
+  double derivatives[kMaxCoefficients];
+  potential_derivatives(
+      source_node.center_of_mass_x - target_node.center_of_mass_x,
+      source_node.center_of_mass_y - target_node.center_of_mass_y,
+      softening_sq_, order_, derivatives);
+
+  // L(b) = sum M(a) * D(a + b) * (-1)^|b|, |a| + |b| <= order
+  const double* multipole = &multipoles_[source * coefficient_count_];
+  double* local = &locals_[target * coefficient_count_];
+  for (int degree_b = 0; degree_b <= order_; ++degree_b) {
+    double sign = (degree_b % 2 == 0) ? 1.0 : -1.0;
+    for (int j_b = 0; j_b <= degree_b; ++j_b) {
+      int i_b = degree_b - j_b;
+      double sum = 0.0;
+      for (int degree_a = 0; degree_a + degree_b <= order_; ++degree_a) {
+        for (int j_a = 0; j_a <= degree_a; ++j_a) {
+          int i_a = degree_a - j_a;
+          sum += multipole[coefficient_index(i_a, j_a)] *
+                 derivatives[coefficient_index(i_a + i_b, j_a + j_b)];
+        }
+      }
+      local[coefficient_index(i_b, j_b)] += sign * sum;
+    }
+  }
+}
+
+void FmmSolver::particle_to_particle(const Quadtree& tree, int target,
+                                     int source) {
+  const int target_begin = subtree_first_body_[target];
+  const int target_end =
+      target_begin + tree.nodes_[target].subtree_body_count;
+  const int source_begin = subtree_first_body_[source];
+  const int source_count = tree.nodes_[source].subtree_body_count;
+  for (int i = target_begin; i < target_end; ++i) {
+    KernelReal ax = 0.0f;
+    KernelReal ay = 0.0f;
+    accumulate_acceleration(tree.body_x_[i], tree.body_y_[i],
+                            tree.body_x_.data() + source_begin,
+                            tree.body_y_.data() + source_begin,
+                            tree.body_mass_.data() + source_begin,
+                            source_count, softening_sq_, ax, ay);
+    CelestialBody* body = tree.bodies_[i];
+    body->ax += G_ * ax;
+    body->ay += G_ * ay;
+  }
+}
+
+void FmmSolver::evaluate_locals(const Quadtree& tree, int node_index) {
+  const QuadtreeNode& node = tree.nodes_[node_index];
+  if (node.total_mass == 0.0f) {
+    return;
+  }
+  const double* local = &locals_[node_index * coefficient_count_];
+  double powers[kMaxCoefficients];
+
+  if (!is_leaf(tree, node_index)) {
+    // L2L: сдвигаем локальное разложение в центры масс потомков
+    for (int child_index = node.first_child;
+         child_index < node.first_child + 4; ++child_index) {
+      const QuadtreeNode& child = tree.nodes_[child_index];
+      if (child.total_mass == 0.0f) {
+        continue;
+      }
+      scaled_powers(child.center_of_mass_x - node.center_of_mass_x,
+                    child.center_of_mass_y - node.center_of_mass_y, order_,
+                    powers);
+      double* child_local = &locals_[child_index * coefficient_count_];
+      for (int degree = 0; degree <= order_; ++degree) {
+        for (int j = 0; j <= degree; ++j) {
+          int i = degree - j;
+          double sum = 0.0;
+          for (int k = i; k <= order_; ++k) {
+            for (int l = j; k + l <= order_; ++l) {
+              sum += local[coefficient_index(k, l)] *
+                     powers[coefficient_index(k - i, l - j)];
+            }
+          }
+          child_local[coefficient_index(i, j)] += sum;
+        }
+      }
+      evaluate_locals(tree, child_index);
+    }
+    return;
+  }
+
+  // L2P: ускорение — градиент локального разложения в точке тела
+  const int first_body = subtree_first_body_[node_index];
+  for (int i = first_body; i < first_body + node.subtree_body_count; ++i) {
+    scaled_powers(tree.body_x_[i] - node.center_of_mass_x,
+                  tree.body_y_[i] - node.center_of_mass_y, order_ - 1,
+                  powers);
+    double ax = 0.0;
+    double ay = 0.0;
+    for (int degree = 1; degree <= order_; ++degree) {
+      for (int j = 0; j <= degree; ++j) {
+        int k = degree - j;
+        double coefficient = local[coefficient_index(k, j)];
+        if (k > 0) ax += coefficient * powers[coefficient_index(k - 1, j)];
+        if (j > 0) ay += coefficient * powers[coefficient_index(k, j - 1)];
+      }
+    }
+    CelestialBody* body = tree.bodies_[i];
+    body->ax += G_ * static_cast<Real>(ax);
+    body->ay += G_ * static_cast<Real>(ay);
+  }
+}
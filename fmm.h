@@ -0,0 +1,54 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <vector>
+
+class Quadtree;
+class ThreadPool;
+
+// Наибольший поддерживаемый порядок разложений
+constexpr int kMaxFmmOrder = 8;
+
+// Решатель гравитации методом быстрых мультиполей (FMM) на разбиении
+// квадродерева. Узлы описываются декартовыми мультипольными и локальными
+// разложениями смягчённого потенциала вокруг центра масс, хорошо разделённые
+// пары узлов взаимодействуют напрямую (M2L), а тела соседних листьев —
+// попарно. Точность задаётся порядком разложений и углом раскрытия THETA.
+class FmmSolver {
+ public:
+  // Добавляет ускорения ко всем телам дерева. Дерево должно быть построено
+  // через build(), иначе используется обход Барнса-Хата. Разбиение на задачи
+  // меняет списки взаимодействий, поэтому в воспроизводимом режиме
+  // (deterministic) число задач не зависит от числа потоков.
+  void calculate_forces(Quadtree& tree, ThreadPool& pool, int order,
+                        float theta, float G, float softening_factor,
+                        bool deterministic);
+
+ private:
+  int order_ = 0;
+  int coefficient_count_ = 0;
+  float theta_ = 0.0f;
+  float G_ = 0.0f;
+  float softening_sq_ = 0.0f;
+
+  // Коэффициенты разложений узлов, coefficient_count_ на узел
+  std::vector<double> multipoles_;
+  std::vector<double> locals_;
+  // Радиус узла относительно его центра масс
+  std::vector<double> radii_;
+  // Начало непрерывного диапазона тел поддерева узла
+  std::vector<int> subtree_first_body_;
+  // Поддеревья, обрабатываемые параллельно
+  std::vector<int> tasks_;
+  std::vector<int> frontier_;
+
+  bool is_leaf(const Quadtree& tree, int node_index) const;
+  void compute_multipoles(const Quadtree& tree, int node_index);
+  void collect_tasks(const Quadtree& tree, int task_count);
+  void interact(const Quadtree& tree, int target, int source);
+  void multipole_to_local(const Quadtree& tree, int target, int source);
+  void particle_to_particle(const Quadtree& tree, int target, int source);
+  void evaluate_locals(const Quadtree& tree, int node_index);
+};
+
+#endif  // FMM_H
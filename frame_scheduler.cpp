@@ -0,0 +1,68 @@
+#include "frame_scheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+// Наибольшее число шагов за кадр, пока стоимость шага мала или неизвестна
+constexpr int kMaxStepsPerFrame = 256;
+// Вес нового замера в скользящих средних
+constexpr double kCostSmoothing = 0.1;
+// Доля шага, которая добавляется каждому кадру сверх бюджета: даже если
+// отрисовка съедает весь бюджет, симуляция шагает хотя бы раз в 8 кадров
+constexpr double kMinStepsPerFrame = 0.125;
+// Насколько за кадр без шагов снижается оценка их стоимости, чтобы устаревшая
+// оценка не сдерживала шаги после того, как нагрузка спала
+constexpr double kStaleCostDecay = 0.05;
+
+// Дорожание принимается сразу, чтобы под нагрузкой число шагов упало в
+// следующем же кадре, а удешевление — постепенно
+void update_cost(double& cost, double measured) {
+  if (measured > cost) {
+    cost = measured;
+  } else {
+    cost += kCostSmoothing * (measured - cost);
+  }
+}
+
+}  // namespace
+
+void FrameScheduler::set_adaptive(bool adaptive) {
+  adaptive_ = adaptive;
+  carry_ = 0.0;
+}
+
+void FrameScheduler::set_manual_speed(int steps_per_frame) {
+  manual_speed_ = std::max(steps_per_frame, 1);
+}
+
+int FrameScheduler::steps_for_frame() {
+  if (!adaptive_) {
+    return manual_speed_;
+  }
+  if (step_cost_ <= 0.0) {
+    return 1;  // первый кадр измеряет стоимость шага
+  }
+  double available =
+      std::max(frame_budget_ - render_cost_, 0.0) / step_cost_ + carry_ +
+      kMinStepsPerFrame;
+  int steps = std::min(static_cast<int>(available), kMaxStepsPerFrame);
+  // Переносится не больше одного шага, чтобы после перегрузки не догонять
+  carry_ = std::min(std::max(available - steps, 0.0), 1.0);
+  return steps;
+}
+
+void FrameScheduler::report_frame(int steps, double step_seconds,
+                                  double render_seconds) {
+  if (steps > 0) {
+    update_cost(step_cost_, step_seconds / steps);
+  } else {
+    step_cost_ *= 1.0 - kStaleCostDecay;
+  }
+  update_cost(render_cost_, render_seconds);
+  report_steps(steps);
+}
+
+void FrameScheduler::report_steps(int steps) {
+  average_steps_ += kCostSmoothing * (steps - average_steps_);
+}
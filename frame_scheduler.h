@@ -0,0 +1,40 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+// Подбирает число шагов симуляции на кадр. Вручную шагов задаётся ровно
+// столько, сколько выбрано. В адаптивном режиме шагов столько, сколько
+// укладывается в бюджет кадра за вычетом отрисовки, по оценке стоимости шага
+// за прошлые кадры. Дробная часть шага переносится на следующие кадры, поэтому
+// шаг дороже бюджета выполняется раз в несколько кадров, а отрисовка не ждёт.
+// Небольшая доля шага добавляется каждому кадру, так что симуляция не
+// останавливается, даже когда одна отрисовка дольше бюджета.
+class FrameScheduler {
+ public:
+  void set_adaptive(bool adaptive);
+  bool is_adaptive() const { return adaptive_; }
+  void set_manual_speed(int steps_per_frame);
+  int get_manual_speed() const { return manual_speed_; }
+  void set_frame_budget(double seconds) { frame_budget_ = seconds; }
+  double get_frame_budget() const { return frame_budget_; }
+  // Среднее число шагов за последние кадры
+  double get_average_steps() const { return average_steps_; }
+
+  // Число шагов для очередного кадра
+  int steps_for_frame();
+  // Сообщает, сколько заняли шаги кадра и его отрисовка, в секундах
+  void report_frame(int steps, double step_seconds, double render_seconds);
+  // Сообщает число шагов за кадр, когда физика шагает в другом потоке
+  void report_steps(int steps);
+
+ private:
+  bool adaptive_ = false;
+  int manual_speed_ = 1;
+  double frame_budget_ = 0.016;
+  // Оценки стоимости шага и отрисовки (0 — ещё не измерена)
+  double step_cost_ = 0.0;
+  double render_cost_ = 0.0;
+  double carry_ = 0.0;  // доля шага, перенесённая с прошлых кадров
+  double average_steps_ = 1.0;
+};
+
+#endif  // FRAME_SCHEDULER_H
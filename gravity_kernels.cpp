@@ -0,0 +1,424 @@
+#include "gravity_kernels.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+namespace {
+
+template <typename T>
+void accumulate_scalar(T x, T y, const T* source_x, const T* source_y,
+                       const T* source_mass, int begin, int count,
+                       T softening_sq, T& ax, T& ay) {
+  for (int i = begin; i < count; ++i) {
+    T dx = source_x[i] - x;
+    T dy = source_y[i] - y;
+    T dist_sq = dx * dx + dy * dy + softening_sq;
+    if (dist_sq <= T(0)) continue;
+    T inv_dist = T(1) / std::sqrt(dist_sq);
+    T scale = source_mass[i] * inv_dist * inv_dist * inv_dist;
+    ax += dx * scale;
+    ay += dy * scale;
+  }
+}
+
+// Квадрупольная поправка к монополю источника, d = источник - цель,
+// s = |d|^2 + eps^2:
+// a = d * (m / s^(3/2) + 3 / s^(5/2) * (5/2 * (d I d) / s - tr(I) / 2))
+//     - 3 / s^(5/2) * I d
+template <typename T>
+void accumulate_quadrupole_scalar(T x, T y, const T* source_x,
+                                  const T* source_y, const T* source_mass,
+                                  const T* source_xx, const T* source_xy,
+                                  const T* source_yy, int begin, int count,
+                                  T softening_sq, T& ax, T& ay) {
+  for (int i = begin; i < count; ++i) {
+    T dx = source_x[i] - x;
+    T dy = source_y[i] - y;
+    T dist_sq = dx * dx + dy * dy + softening_sq;
+    if (dist_sq <= T(0)) continue;
+    T inv_dist_sq = T(1) / dist_sq;
+    T inv_dist_cube = inv_dist_sq * std::sqrt(inv_dist_sq);
+    T h = T(3) * inv_dist_cube * inv_dist_sq;
+    T ix = source_xx[i] * dx + source_xy[i] * dy;
+    T iy = source_xy[i] * dx + source_yy[i] * dy;
+    T d_i_d = ix * dx + iy * dy;
+    T trace = source_xx[i] + source_yy[i];
+    T radial = source_mass[i] * inv_dist_cube +
+               h * (T(2.5) * d_i_d * inv_dist_sq - T(0.5) * trace);
+    ax += dx * radial - h * ix;
+    ay += dy * radial - h * iy;
+  }
+}
+
+}  // namespace
+
+#if defined(__AVX__)
+
+void accumulate_acceleration(float x, float y, const float* source_x,
+                             const float* source_y, const float* source_mass,
+                             int count, float softening_sq, float& ax,
+                             float& ay) {
+  const __m256 target_x = _mm256_set1_ps(x);
+  const __m256 target_y = _mm256_set1_ps(y);
+  const __m256 eps_sq = _mm256_set1_ps(softening_sq);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 three_halves = _mm256_set1_ps(1.5f);
+  __m256 sum_x = zero;
+  __m256 sum_y = zero;
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(source_x + i), target_x);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(source_y + i), target_y);
+    __m256 dist_sq = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), eps_sq);
+    // Приближённый обратный корень с одной итерацией Ньютона
+    __m256 inv_dist = _mm256_rsqrt_ps(dist_sq);
+    inv_dist = _mm256_mul_ps(
+        inv_dist,
+        _mm256_sub_ps(three_halves,
+                      _mm256_mul_ps(_mm256_mul_ps(half, dist_sq),
+                                    _mm256_mul_ps(inv_dist, inv_dist))));
+    __m256 inv_dist_cube =
+        _mm256_mul_ps(_mm256_mul_ps(inv_dist, inv_dist), inv_dist);
+    inv_dist_cube = _mm256_and_ps(inv_dist_cube,
+                                  _mm256_cmp_ps(dist_sq, zero, _CMP_GT_OQ));
+    __m256 scale = _mm256_mul_ps(_mm256_loadu_ps(source_mass + i),
+                                 inv_dist_cube);
+    sum_x = _mm256_add_ps(sum_x, _mm256_mul_ps(dx, scale));
+    sum_y = _mm256_add_ps(sum_y, _mm256_mul_ps(dy, scale));
+  }
+
+  alignas(32) float lanes_x[8];
+  alignas(32) float lanes_y[8];
+  _mm256_store_ps(lanes_x, sum_x);
+  _mm256_store_ps(lanes_y, sum_y);
+  for (int lane = 0; lane < 8; ++lane) {
+    ax += lanes_x[lane];
+    ay += lanes_y[lane];
+  }
+  accumulate_scalar(x, y, source_x, source_y, source_mass, i, count,
+                    softening_sq, ax, ay);
+}
+
+void accumulate_quadrupole_acceleration(
+    float x, float y, const float* source_x, const float* source_y,
+    const float* source_mass, const float* source_xx, const float* source_xy,
+    const float* source_yy, int count, float softening_sq, float& ax,
+    float& ay) {
+  const __m256 target_x = _mm256_set1_ps(x);
+  const __m256 target_y = _mm256_set1_ps(y);
+  const __m256 eps_sq = _mm256_set1_ps(softening_sq);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 three_halves = _mm256_set1_ps(1.5f);
+  const __m256 three = _mm256_set1_ps(3.0f);
+  const __m256 five_halves = _mm256_set1_ps(2.5f);
+  __m256 sum_x = zero;
+  __m256 sum_y = zero;
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(source_x + i), target_x);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(source_y + i), target_y);
+    __m256 dist_sq = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), eps_sq);
+    __m256 inv_dist = _mm256_rsqrt_ps(dist_sq);
+    inv_dist = _mm256_mul_ps(
+        inv_dist,
+        _mm256_sub_ps(three_halves,
+                      _mm256_mul_ps(_mm256_mul_ps(half, dist_sq),
+                                    _mm256_mul_ps(inv_dist, inv_dist))));
+    inv_dist = _mm256_and_ps(inv_dist,
+                             _mm256_cmp_ps(dist_sq, zero, _CMP_GT_OQ));
+    __m256 inv_dist_sq = _mm256_mul_ps(inv_dist, inv_dist);
+    __m256 inv_dist_cube = _mm256_mul_ps(inv_dist_sq, inv_dist);
+    __m256 h = _mm256_mul_ps(three, _mm256_mul_ps(inv_dist_cube, inv_dist_sq));
+    __m256 xx = _mm256_loadu_ps(source_xx + i);
+    __m256 xy = _mm256_loadu_ps(source_xy + i);
+    __m256 yy = _mm256_loadu_ps(source_yy + i);
+    __m256 ix = _mm256_add_ps(_mm256_mul_ps(xx, dx), _mm256_mul_ps(xy, dy));
+    __m256 iy = _mm256_add_ps(_mm256_mul_ps(xy, dx), _mm256_mul_ps(yy, dy));
+    __m256 d_i_d = _mm256_add_ps(_mm256_mul_ps(ix, dx), _mm256_mul_ps(iy, dy));
+    __m256 trace = _mm256_add_ps(xx, yy);
+    __m256 correction = _mm256_sub_ps(
+        _mm256_mul_ps(five_halves, _mm256_mul_ps(d_i_d, inv_dist_sq)),
+        _mm256_mul_ps(half, trace));
+    __m256 radial = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(source_mass + i), inv_dist_cube),
+        _mm256_mul_ps(h, correction));
+    sum_x = _mm256_add_ps(
+        sum_x, _mm256_sub_ps(_mm256_mul_ps(dx, radial), _mm256_mul_ps(h, ix)));
+    sum_y = _mm256_add_ps(
+        sum_y, _mm256_sub_ps(_mm256_mul_ps(dy, radial), _mm256_mul_ps(h, iy)));
+  }
+
+  alignas(32) float lanes_x[8];
+  alignas(32) float lanes_y[8];
+  _mm256_store_ps(lanes_x, sum_x);
+  _mm256_store_ps(lanes_y, sum_y);
+  for (int lane = 0; lane < 8; ++lane) {
+    ax += lanes_x[lane];
+    ay += lanes_y[lane];
+  }
+  accumulate_quadrupole_scalar(x, y, source_x, source_y, source_mass,
+                               source_xx, source_xy, source_yy, i, count,
+                               softening_sq, ax, ay);
+}
+
+#elif defined(__SSE2__)
+
+void accumulate_acceleration(float x, float y, const float* source_x,
+                             const float* source_y, const float* source_mass,
+                             int count, float softening_sq, float& ax,
+                             float& ay) {
+  const __m128 target_x = _mm_set1_ps(x);
+  const __m128 target_y = _mm_set1_ps(y);
+  const __m128 eps_sq = _mm_set1_ps(softening_sq);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 three_halves = _mm_set1_ps(1.5f);
+  __m128 sum_x = zero;
+  __m128 sum_y = zero;
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(source_x + i), target_x);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(source_y + i), target_y);
+    __m128 dist_sq =
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), eps_sq);
+    // Приближённый обратный корень с одной итерацией Ньютона
+    __m128 inv_dist = _mm_rsqrt_ps(dist_sq);
+    inv_dist = _mm_mul_ps(
+        inv_dist, _mm_sub_ps(three_halves,
+                             _mm_mul_ps(_mm_mul_ps(half, dist_sq),
+                                        _mm_mul_ps(inv_dist, inv_dist))));
+    __m128 inv_dist_cube = _mm_mul_ps(_mm_mul_ps(inv_dist, inv_dist), inv_dist);
+    inv_dist_cube = _mm_and_ps(inv_dist_cube, _mm_cmpgt_ps(dist_sq, zero));
+    __m128 scale = _mm_mul_ps(_mm_loadu_ps(source_mass + i), inv_dist_cube);
+    sum_x = _mm_add_ps(sum_x, _mm_mul_ps(dx, scale));
+    sum_y = _mm_add_ps(sum_y, _mm_mul_ps(dy, scale));
+  }
+
+  alignas(16) float lanes_x[4];
+  alignas(16) float lanes_y[4];
+  _mm_store_ps(lanes_x, sum_x);
+  _mm_store_ps(lanes_y, sum_y);
+  for (int lane = 0; lane < 4; ++lane) {
+    ax += lanes_x[lane];
+    ay += lanes_y[lane];
+  }
+  accumulate_scalar(x, y, source_x, source_y, source_mass, i, count,
+                    softening_sq, ax, ay);
+}
+
+void accumulate_quadrupole_acceleration(
+    float x, float y, const float* source_x, const float* source_y,
+    const float* source_mass, const float* source_xx, const float* source_xy,
+    const float* source_yy, int count, float softening_sq, float& ax,
+    float& ay) {
+  const __m128 target_x = _mm_set1_ps(x);
+  const __m128 target_y = _mm_set1_ps(y);
+  const __m128 eps_sq = _mm_set1_ps(softening_sq);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 three_halves = _mm_set1_ps(1.5f);
+  const __m128 three = _mm_set1_ps(3.0f);
+  const __m128 five_halves = _mm_set1_ps(2.5f);
+  __m128 sum_x = zero;
+  __m128 sum_y = zero;
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(source_x + i), target_x);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(source_y + i), target_y);
+    __m128 dist_sq =
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), eps_sq);
+    __m128 inv_dist = _mm_rsqrt_ps(dist_sq);
+    inv_dist = _mm_mul_ps(
+        inv_dist, _mm_sub_ps(three_halves,
+                             _mm_mul_ps(_mm_mul_ps(half, dist_sq),
+                                        _mm_mul_ps(inv_dist, inv_dist))));
+    inv_dist = _mm_and_ps(inv_dist, _mm_cmpgt_ps(dist_sq, zero));
+    __m128 inv_dist_sq = _mm_mul_ps(inv_dist, inv_dist);
+    __m128 inv_dist_cube = _mm_mul_ps(inv_dist_sq, inv_dist);
+    __m128 h = _mm_mul_ps(three, _mm_mul_ps(inv_dist_cube, inv_dist_sq));
+    __m128 xx = _mm_loadu_ps(source_xx + i);
+    __m128 xy = _mm_loadu_ps(source_xy + i);
+    __m128 yy = _mm_loadu_ps(source_yy + i);
+    __m128 ix = _mm_add_ps(_mm_mul_ps(xx, dx), _mm_mul_ps(xy, dy));
+    __m128 iy = _mm_add_ps(_mm_mul_ps(xy, dx), _mm_mul_ps(yy, dy));
+    __m128 d_i_d = _mm_add_ps(_mm_mul_ps(ix, dx), _mm_mul_ps(iy, dy));
+    __m128 trace = _mm_add_ps(xx, yy);
+    __m128 radial = _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(source_mass + i), inv_dist_cube),
+        _mm_mul_ps(h, _mm_sub_ps(_mm_mul_ps(five_halves,
+                                            _mm_mul_ps(d_i_d, inv_dist_sq)),
+                                 _mm_mul_ps(half, trace))));
+    sum_x = _mm_add_ps(sum_x,
+                       _mm_sub_ps(_mm_mul_ps(dx, radial), _mm_mul_ps(h, ix)));
+    sum_y = _mm_add_ps(sum_y,
+                       _mm_sub_ps(_mm_mul_ps(dy, radial), _mm_mul_ps(h, iy)));
+  }
+
+  alignas(16) float lanes_x[4];
+  alignas(16) float lanes_y[4];
+  _mm_store_ps(lanes_x, sum_x);
+  _mm_store_ps(lanes_y, sum_y);
+  for (int lane = 0; lane < 4; ++lane) {
+    ax += lanes_x[lane];
+    ay += lanes_y[lane];
+  }
+  accumulate_quadrupole_scalar(x, y, source_x, source_y, source_mass,
+                               source_xx, source_xy, source_yy, i, count,
+                               softening_sq, ax, ay);
+}
+
+#elif defined(__wasm_simd128__)
+
+void accumulate_acceleration(float x, float y, const float* source_x,
+                             const float* source_y, const float* source_mass,
+                             int count, float softening_sq, float& ax,
+                             float& ay) {
+  const v128_t target_x = wasm_f32x4_splat(x);
+  const v128_t target_y = wasm_f32x4_splat(y);
+  const v128_t eps_sq = wasm_f32x4_splat(softening_sq);
+  const v128_t zero = wasm_f32x4_splat(0.0f);
+  const v128_t one = wasm_f32x4_splat(1.0f);
+  v128_t sum_x = zero;
+  v128_t sum_y = zero;
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    v128_t dx = wasm_f32x4_sub(wasm_v128_load(source_x + i), target_x);
+    v128_t dy = wasm_f32x4_sub(wasm_v128_load(source_y + i), target_y);
+    v128_t dist_sq = wasm_f32x4_add(
+        wasm_f32x4_add(wasm_f32x4_mul(dx, dx), wasm_f32x4_mul(dy, dy)),
+        eps_sq);
+    // В WASM SIMD нет приближённого обратного корня
+    v128_t inv_dist_cube = wasm_f32x4_div(
+        one, wasm_f32x4_mul(dist_sq, wasm_f32x4_sqrt(dist_sq)));
+    inv_dist_cube =
+        wasm_v128_and(inv_dist_cube, wasm_f32x4_gt(dist_sq, zero));
+    v128_t scale =
+        wasm_f32x4_mul(wasm_v128_load(source_mass + i), inv_dist_cube);
+    sum_x = wasm_f32x4_add(sum_x, wasm_f32x4_mul(dx, scale));
+    sum_y = wasm_f32x4_add(sum_y, wasm_f32x4_mul(dy, scale));
+  }
+
+  ax += wasm_f32x4_extract_lane(sum_x, 0) + wasm_f32x4_extract_lane(sum_x, 1) +
+        wasm_f32x4_extract_lane(sum_x, 2) + wasm_f32x4_extract_lane(sum_x, 3);
+  ay += wasm_f32x4_extract_lane(sum_y, 0) + wasm_f32x4_extract_lane(sum_y, 1) +
+        wasm_f32x4_extract_lane(sum_y, 2) + wasm_f32x4_extract_lane(sum_y, 3);
+  accumulate_scalar(x, y, source_x, source_y, source_mass, i, count,
+                    softening_sq, ax, ay);
+}
+
+void accumulate_quadrupole_acceleration(
+    float x, float y, const float* source_x, const float* source_y,
+    const float* source_mass, const float* source_xx, const float* source_xy,
+    const float* source_yy, int count, float softening_sq, float& ax,
+    float& ay) {
+  const v128_t target_x = wasm_f32x4_splat(x);
+  const v128_t target_y = wasm_f32x4_splat(y);
+  const v128_t eps_sq = wasm_f32x4_splat(softening_sq);
+  const v128_t zero = wasm_f32x4_splat(0.0f);
+  const v128_t one = wasm_f32x4_splat(1.0f);
+  const v128_t half = wasm_f32x4_splat(0.5f);
+  const v128_t three = wasm_f32x4_splat(3.0f);
+  const v128_t five_halves = wasm_f32x4_splat(2.5f);
+  v128_t sum_x = zero;
+  v128_t sum_y = zero;
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    v128_t dx = wasm_f32x4_sub(wasm_v128_load(source_x + i), target_x);
+    v128_t dy = wasm_f32x4_sub(wasm_v128_load(source_y + i), target_y);
+    v128_t dist_sq = wasm_f32x4_add(
+        wasm_f32x4_add(wasm_f32x4_mul(dx, dx), wasm_f32x4_mul(dy, dy)),
+        eps_sq);
+    v128_t inv_dist_sq = wasm_f32x4_div(one, dist_sq);
+    inv_dist_sq = wasm_v128_and(inv_dist_sq, wasm_f32x4_gt(dist_sq, zero));
+    v128_t inv_dist_cube =
+        wasm_f32x4_mul(inv_dist_sq, wasm_f32x4_sqrt(inv_dist_sq));
+    v128_t h =
+        wasm_f32x4_mul(three, wasm_f32x4_mul(inv_dist_cube, inv_dist_sq));
+    v128_t xx = wasm_v128_load(source_xx + i);
+    v128_t xy = wasm_v128_load(source_xy + i);
+    v128_t yy = wasm_v128_load(source_yy + i);
+    v128_t ix = wasm_f32x4_add(wasm_f32x4_mul(xx, dx), wasm_f32x4_mul(xy, dy));
+    v128_t iy = wasm_f32x4_add(wasm_f32x4_mul(xy, dx), wasm_f32x4_mul(yy, dy));
+    v128_t d_i_d =
+        wasm_f32x4_add(wasm_f32x4_mul(ix, dx), wasm_f32x4_mul(iy, dy));
+    v128_t trace = wasm_f32x4_add(xx, yy);
+    v128_t radial = wasm_f32x4_add(
+        wasm_f32x4_mul(wasm_v128_load(source_mass + i), inv_dist_cube),
+        wasm_f32x4_mul(
+            h, wasm_f32x4_sub(
+                   wasm_f32x4_mul(five_halves,
+                                  wasm_f32x4_mul(d_i_d, inv_dist_sq)),
+                   wasm_f32x4_mul(half, trace))));
+    sum_x = wasm_f32x4_add(
+        sum_x,
+        wasm_f32x4_sub(wasm_f32x4_mul(dx, radial), wasm_f32x4_mul(h, ix)));
+    sum_y = wasm_f32x4_add(
+        sum_y,
+        wasm_f32x4_sub(wasm_f32x4_mul(dy, radial), wasm_f32x4_mul(h, iy)));
+  }
+
+  ax += wasm_f32x4_extract_lane(sum_x, 0) + wasm_f32x4_extract_lane(sum_x, 1) +
+        wasm_f32x4_extract_lane(sum_x, 2) + wasm_f32x4_extract_lane(sum_x, 3);
+  ay += wasm_f32x4_extract_lane(sum_y, 0) + wasm_f32x4_extract_lane(sum_y, 1) +
+        wasm_f32x4_extract_lane(sum_y, 2) + wasm_f32x4_extract_lane(sum_y, 3);
+  accumulate_quadrupole_scalar(x, y, source_x, source_y, source_mass,
+                               source_xx, source_xy, source_yy, i, count,
+                               softening_sq, ax, ay);
+}
+
+#else
+
+void accumulate_acceleration(float x, float y, const float* source_x,
+                             const float* source_y, const float* source_mass,
+                             int count, float softening_sq, float& ax,
+                             float& ay) {
+  accumulate_scalar(x, y, source_x, source_y, source_mass, 0, count,
+                    softening_sq, ax, ay);
+}
+
+void accumulate_quadrupole_acceleration(
+    float x, float y, const float* source_x, const float* source_y,
+    const float* source_mass, const float* source_xx, const float* source_xy,
+    const float* source_yy, int count, float softening_sq, float& ax,
+    float& ay) {
+  accumulate_quadrupole_scalar(x, y, source_x, source_y, source_mass,
+                               source_xx, source_xy, source_yy, 0, count,
+                               softening_sq, ax, ay);
+}
+
+#endif
+
+void accumulate_acceleration(double x, double y, const double* source_x,
+                             const double* source_y, const double* source_mass,
+                             int count, double softening_sq, double& ax,
+                             double& ay) {
+  accumulate_scalar(x, y, source_x, source_y, source_mass, 0, count,
+                    softening_sq, ax, ay);
+}
+
+void accumulate_quadrupole_acceleration(
+    double x, double y, const double* source_x, const double* source_y,
+    const double* source_mass, const double* source_xx,
+    const double* source_xy, const double* source_yy, int count,
+    double softening_sq, double& ax, double& ay) {
+  accumulate_quadrupole_scalar(x, y, source_x, source_y, source_mass,
+                               source_xx, source_xy, source_yy, 0, count,
+                               softening_sq, ax, ay);
+}
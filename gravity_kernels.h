@@ -0,0 +1,36 @@
+#ifndef GRAVITY_KERNELS_H
+#define GRAVITY_KERNELS_H
+
+// Векторизованные ядра парного взаимодействия. Источники — тела или монополи
+// узлов дерева — передаются массивами SoA, для всех используется смягчение
+// Пламмера: a = m * d / (|d|^2 + eps^2)^(3/2).
+//
+// Добавляет к (ax, ay) ускорение цели в точке (x, y) от count источников без
+// множителя G. Источник в той же точке, что и цель, вклада не даёт.
+void accumulate_acceleration(float x, float y, const float* source_x,
+                             const float* source_y, const float* source_mass,
+                             int count, float softening_sq, float& ax,
+                             float& ay);
+
+// То же для узлов дерева с квадрупольной поправкой. Для каждого источника,
+// кроме массы в центре масс, передаются вторые моменты распределения массы
+// относительно центра масс: Ixx = sum m dx^2, Ixy = sum m dx dy,
+// Iyy = sum m dy^2.
+void accumulate_quadrupole_acceleration(
+    float x, float y, const float* source_x, const float* source_y,
+    const float* source_mass, const float* source_xx, const float* source_xy,
+    const float* source_yy, int count, float softening_sq, float& ax,
+    float& ay);
+
+// Скалярные варианты в double для сборки с SOLAR_SIM_PRECISION=double
+void accumulate_acceleration(double x, double y, const double* source_x,
+                             const double* source_y, const double* source_mass,
+                             int count, double softening_sq, double& ax,
+                             double& ay);
+void accumulate_quadrupole_acceleration(
+    double x, double y, const double* source_x, const double* source_y,
+    const double* source_mass, const double* source_xx,
+    const double* source_xy, const double* source_yy, int count,
+    double softening_sq, double& ax, double& ay);
+
+#endif  // GRAVITY_KERNELS_H
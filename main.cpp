@@ -0,0 +1,522 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <atomic>
+#include <thread>
+#endif
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#include <emscripten/bind.h>
+#include <emscripten/html5.h>
+#endif
+#include "frame_scheduler.h"
+#include "quadtree.h"
+#include "renderer.h"
+#include "simulation.h"
+#include "snapshot_buffer.h"
+
+struct SimulationContext {
+  Renderer* renderer;
+  std::vector<CelestialBody>* bodies;
+  SimulationParameters* params;
+  Quadtree** quadtree;
+  SimulationWorkspace* workspace;
+};
+
+#ifdef __EMSCRIPTEN__
+// Global context for the callback
+SimulationContext* g_context = nullptr;
+
+EM_BOOL on_web_display_size_changed(int event_type,
+                                    const EmscriptenUiEvent* ui_event,
+                                    void* user_data) {
+  double width, height;
+  emscripten_get_element_css_size("canvas", &width, &height);
+  emscripten_set_canvas_element_size("#canvas", (int)width, (int)height);
+  if (g_context && g_context->renderer) {
+    g_context->renderer->handle_resize((int)width, (int)height);
+  }
+  return EM_TRUE;
+}
+#endif
+
+bool stateLoaded = false;
+
+bool isStateLoaded() { return stateLoaded; }
+
+void markStateAsLoaded() { stateLoaded = true; }
+
+// Глобальные переменные для симуляции
+std::vector<CelestialBody> g_bodies;
+SimulationParameters g_params;
+Renderer* g_renderer = nullptr;
+FrameScheduler g_scheduler;
+Quadtree* g_quadtree = nullptr;
+SimulationWorkspace g_workspace;
+// Время отрисовки и кадров, пишет только главный поток
+RollingHistogram g_render_times;
+RollingHistogram g_frame_times;
+// Детализация по размеру пикселя: тела узлов дерева меньше пикселя рисуются
+// одной точкой
+bool g_level_of_detail = true;
+
+// Тела, параметры и дерево меняют и шаги симуляции, и вызовы из JavaScript.
+// В однопоточной сборке блокировка ни с кем не конкурирует.
+std::mutex g_simulation_mutex;
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+// В многопоточной сборке физика шагает в своём потоке и публикует снимки тел,
+// а главный поток только рисует их, поэтому тяжёлый шаг не задерживает кадры
+// и жесты
+SnapshotTripleBuffer g_snapshots;
+SnapshotInterpolator g_interpolator;
+std::vector<BodyVertex> g_interpolated_vertices;
+bool g_interpolation = true;
+// Шагов физики на кадр 60 Гц, 0 — шагать без пауз (адаптивный режим)
+std::atomic<int> g_worker_speed{1};
+// Копия профиля шагов, которую поток физики обновляет после каждой серии
+// шагов, чтобы оверлей не ждал окончания шага
+std::mutex g_profile_mutex;
+PerformanceProfile g_worker_profile;
+// Видимая область, по которой поток физики отбирает тела снимков. Пишет
+// главный поток при каждом кадре; до первого кадра видно всё.
+std::mutex g_view_mutex;
+RenderView g_render_view = {std::numeric_limits<float>::lowest(),
+                            std::numeric_limits<float>::lowest(),
+                            std::numeric_limits<float>::max(),
+                            std::numeric_limits<float>::max()};
+// Сколько вызовов из главного потока ждут g_simulation_mutex. std::mutex не
+// справедлив, и поток физики, захватывающий его сразу после шага, мог бы
+// надолго задержать главный поток. Пока счётчик не ноль, поток физики не
+// захватывает блокировку.
+std::atomic<int> g_lock_requests{0};
+#else
+// Вершины видимых тел, пересчитываются каждый кадр
+std::vector<BodyVertex> g_visible_vertices;
+#endif
+
+// Блокировка симуляции для вызовов из главного потока: поток физики уступает
+// ей очередь
+class SimulationLock {
+ public:
+  SimulationLock() {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    g_lock_requests.fetch_add(1, std::memory_order_acq_rel);
+#endif
+    g_simulation_mutex.lock();
+#ifdef __EMSCRIPTEN_PTHREADS__
+    g_lock_requests.fetch_sub(1, std::memory_order_acq_rel);
+#endif
+  }
+  ~SimulationLock() { g_simulation_mutex.unlock(); }
+
+  SimulationLock(const SimulationLock&) = delete;
+  SimulationLock& operator=(const SimulationLock&) = delete;
+};
+
+// Сбрасывает тела и дерево; вызывающий держит g_simulation_mutex
+void reset_simulation() {
+  initialize_bodies(g_bodies, g_params);
+  g_workspace.accelerations_valid = false;
+  if (g_quadtree) {
+    delete g_quadtree;
+  }
+  Boundary boundary = {0.0f, 0.0f, g_params.INITIALIZATION_RADIUS * 2.0f};
+  g_quadtree = new Quadtree(boundary, 4);
+}
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+// Поток физики: шагает без остановки и публикует снимок после каждой серии
+// шагов. Ручная скорость — шагов на кадр 60 Гц, в адаптивном режиме пауз нет.
+void physics_loop() {
+  using Clock = std::chrono::steady_clock;
+  const Clock::duration frame_period = std::chrono::microseconds(16667);
+  Clock::time_point next_frame = Clock::now();
+  for (;;) {
+    const int speed = g_worker_speed.load(std::memory_order_relaxed);
+    const int steps = std::max(speed, 1);
+    PerformanceProfile profile;
+    // Блокировка берётся на каждый шаг, и перед каждым шагом сначала
+    // обслуживаются ждущие вызовы главного потока
+    for (int i = 0; i < steps; ++i) {
+      while (g_lock_requests.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+      }
+      std::lock_guard<std::mutex> lock(g_simulation_mutex);
+      update_simulation(g_bodies, *g_quadtree, g_params, g_workspace);
+      if (i + 1 < steps) {
+        continue;
+      }
+      RenderView view;
+      {
+        std::lock_guard<std::mutex> view_lock(g_view_mutex);
+        view = g_render_view;
+      }
+      write_snapshot(g_bodies, *g_quadtree, view,
+                     g_workspace.phase_times.step_count,
+                     g_snapshots.write_buffer());
+      profile = g_workspace.profile;
+    }
+    // Буфер писателя принадлежит только этому потоку, публикация и копия
+    // профиля блокировки симуляции не требуют
+    g_snapshots.publish();
+    {
+      std::lock_guard<std::mutex> profile_lock(g_profile_mutex);
+      g_worker_profile = std::move(profile);
+    }
+    if (speed > 0) {
+      next_frame = std::max(next_frame + frame_period, Clock::now());
+      std::this_thread::sleep_until(next_frame);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Вершины для кадра: последний снимок или, с интерполяцией, положения между
+// двумя последними. Промежуток между снимками измеряется по их приходу в
+// главный поток, так что изображение отстаёт от физики на один снимок.
+const std::vector<BodyVertex>& get_frame_vertices() {
+  using Clock = std::chrono::steady_clock;
+  static Clock::time_point previous_arrival;
+  static Clock::time_point latest_arrival;
+  static int64_t shown_step_count = 0;
+  const Clock::time_point now = Clock::now();
+  if (g_snapshots.acquire()) {
+    previous_arrival = latest_arrival;
+    latest_arrival = now;
+    // Сопоставление обновляется и при выключенной интерполяции: после её
+    // включения оно должно соответствовать текущей паре снимков
+    g_interpolator.match(g_snapshots.previous(), g_snapshots.latest());
+  }
+  const Snapshot& latest = g_snapshots.latest();
+  const Snapshot& previous = g_snapshots.previous();
+  g_scheduler.report_steps(
+      static_cast<int>(std::max<int64_t>(latest.step_count - shown_step_count,
+                                         0)));
+  shown_step_count = latest.step_count;
+
+  if (!g_interpolation || previous.vertices.empty() ||
+      latest_arrival == previous_arrival) {
+    return latest.vertices;
+  }
+  const float alpha = std::min(
+      std::chrono::duration<float>(now - latest_arrival).count() /
+          std::chrono::duration<float>(latest_arrival - previous_arrival)
+              .count(),
+      1.0f);
+  g_interpolator.interpolate(previous, latest, alpha, g_interpolated_vertices);
+  return g_interpolated_vertices;
+}
+#endif
+
+#ifdef __EMSCRIPTEN__
+// Видимая область для отбора тел при текущем виде
+RenderView get_render_view(const Renderer& renderer, float max_radius) {
+  RenderView view = renderer.get_view();
+  // Точка не меньше двух пикселей. Запас в два радиуса самого крупного из
+  // начальных тел покрывает его рост при слияниях и смещение тел за шаг.
+  view.margin = 2.0f * max_radius + view.pixel_size;
+  if (!g_level_of_detail) {
+    view.pixel_size = 0.0f;
+  }
+#ifdef __EMSCRIPTEN_PTHREADS__
+  // Снимок рисуется позже, чем отобран, поэтому при сдвиге вида его края
+  // должны быть уже заполнены: берём ещё четверть видимой области
+  view.margin += 0.25f * std::max(view.max_x - view.min_x,
+                                  view.max_y - view.min_y);
+#endif
+  return view;
+}
+
+void main_loop(void* arg) {
+  SimulationContext* context = static_cast<SimulationContext*>(arg);
+  ScopedSample frame_sample(g_frame_times);
+  float min_radius = std::cbrt(
+      std::min(context->params->MIN_MASS, context->params->CENTRAL_BODY_MASS) /
+      context->params->DENSITY);
+  float max_radius = std::cbrt(
+      std::max(context->params->MAX_MASS, context->params->CENTRAL_BODY_MASS) /
+      context->params->DENSITY);
+  const RenderView view = get_render_view(*context->renderer, max_radius);
+#ifdef __EMSCRIPTEN_PTHREADS__
+  {
+    std::lock_guard<std::mutex> lock(g_view_mutex);
+    g_render_view = view;
+  }
+  const std::vector<BodyVertex>& vertices = get_frame_vertices();
+#else
+  const int steps = g_scheduler.steps_for_frame();
+  const auto step_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < steps; ++i) {
+    update_simulation(*context->bodies, **context->quadtree, *context->params,
+                      *context->workspace);
+  }
+  // Отбор видимых тел зависит от экрана, а не от числа шагов, и считается
+  // временем отрисовки
+  const auto render_start = std::chrono::steady_clock::now();
+  // Если дерево построено не по этим телам (сразу после сброса), рисуются
+  // все тела
+  if (!(*context->quadtree)
+           ->collect_visible_vertices(*context->bodies, view,
+                                      g_visible_vertices)) {
+    write_body_vertices(*context->bodies, g_visible_vertices);
+  }
+  const std::vector<BodyVertex>& vertices = g_visible_vertices;
+#endif
+  {
+    ScopedSample render_sample(g_render_times);
+    context->renderer->render(vertices, min_radius, max_radius);
+  }
+#ifndef __EMSCRIPTEN_PTHREADS__
+  const auto render_end = std::chrono::steady_clock::now();
+  g_scheduler.report_frame(
+      steps, std::chrono::duration<double>(render_start - step_start).count(),
+      std::chrono::duration<double>(render_end - render_start).count());
+#endif
+}
+#endif
+
+int main(int argc, char* argv[]) {
+  if (!isStateLoaded()) {
+    reset_simulation();
+  }
+
+  int width, height;
+#ifdef __EMSCRIPTEN__
+  emscripten_get_canvas_element_size("#canvas", &width, &height);
+#else
+  width = 800;
+  height = 800;
+#endif
+
+  Renderer renderer(width, height);
+  g_renderer = &renderer;
+  if (!g_renderer->init(g_params.INITIALIZATION_RADIUS)) {
+    return -1;
+  }
+
+#ifdef __EMSCRIPTEN__
+  emscripten::val get_initial_colors =
+      emscripten::val::global("getInitialColors");
+  emscripten::val initial_color_data = get_initial_colors();
+  const std::vector<float> color_vec =
+      emscripten::vecFromJSArray<float>(initial_color_data["colors"]);
+  const std::vector<float> weight_vec =
+      emscripten::vecFromJSArray<float>(initial_color_data["weights"]);
+  g_renderer->set_colors(color_vec, weight_vec);
+#endif
+
+#ifdef __EMSCRIPTEN__
+  static SimulationContext context_instance = {
+      g_renderer, &g_bodies, &g_params, &g_quadtree, &g_workspace};
+  g_context = &context_instance;
+  emscripten_set_resize_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, g_context,
+                                 EM_FALSE, on_web_display_size_changed);
+  on_web_display_size_changed(0, nullptr, g_context);  // Initial call
+#ifdef __EMSCRIPTEN_PTHREADS__
+  std::thread(physics_loop).detach();
+#endif
+  emscripten_set_main_loop_arg(main_loop, g_context, 0, 1);
+#endif
+
+  return 0;
+}
+
+#ifdef __EMSCRIPTEN__
+
+// Функция для сброса симуляции
+void reset_simulation_to_defaults() {
+  SimulationLock lock;
+  g_params = SimulationParameters();
+  reset_simulation();
+}
+
+// Перезапускает симуляцию с текущими параметрами
+void restart_simulation() {
+  SimulationLock lock;
+  reset_simulation();
+}
+
+// Передаёт потоку физики скорость, выбранную в планировщике
+void update_worker_speed() {
+#ifdef __EMSCRIPTEN_PTHREADS__
+  g_worker_speed.store(
+      g_scheduler.is_adaptive() ? 0 : g_scheduler.get_manual_speed(),
+      std::memory_order_relaxed);
+#endif
+}
+
+// В адаптивном режиме скорость — среднее число шагов за последние кадры
+int get_simulation_speed() {
+  if (g_scheduler.is_adaptive()) {
+    return std::max(
+        static_cast<int>(std::lround(g_scheduler.get_average_steps())), 1);
+  }
+  return g_scheduler.get_manual_speed();
+}
+
+// Ручная настройка выключает адаптивный режим и продолжает от его скорости
+void increase_simulation_speed() {
+  const int speed = get_simulation_speed();
+  g_scheduler.set_adaptive(false);
+  g_scheduler.set_manual_speed(speed + 1);
+  update_worker_speed();
+}
+
+void decrease_simulation_speed() {
+  const int speed = get_simulation_speed();
+  g_scheduler.set_adaptive(false);
+  g_scheduler.set_manual_speed(speed - 1);
+  update_worker_speed();
+}
+
+bool is_adaptive_speed() { return g_scheduler.is_adaptive(); }
+
+void set_adaptive_speed(bool adaptive) {
+  g_scheduler.set_adaptive(adaptive);
+  update_worker_speed();
+}
+
+// Бюджет кадра адаптивного режима в миллисекундах
+void set_frame_budget(double milliseconds) {
+  g_scheduler.set_frame_budget(milliseconds * 1e-3);
+}
+
+void set_colors(const emscripten::val& colors, const emscripten::val& weights) {
+  if (g_renderer) {
+    const std::vector<float> color_vec =
+        emscripten::vecFromJSArray<float>(colors);
+    const std::vector<float> weight_vec =
+        emscripten::vecFromJSArray<float>(weights);
+    g_renderer->set_colors(color_vec, weight_vec);
+  }
+}
+
+// Буфер упакованных тел, в который смотрит представление getBodyData()
+std::vector<float> g_packed_bodies;
+
+// Возвращает Float32Array-представление памяти WASM без копирования тел.
+// Представление действительно до следующего вызова getBodyData() или
+// setBodyData() и до роста памяти, поэтому JavaScript должен сразу скопировать
+// его (slice()) или прочитать.
+emscripten::val getBodyData() {
+  SimulationLock lock;
+  pack_bodies(g_bodies, g_packed_bodies);
+  return emscripten::val(emscripten::typed_memory_view(g_packed_bodies.size(),
+                                                       g_packed_bodies.data()));
+}
+
+// Принимает Float32Array в упакованном формате и копирует его в память WASM
+// одним вызовом set()
+void setBodyData(const emscripten::val& data) {
+  SimulationLock lock;
+  const int body_count = data["length"].as<int>() / kPackedBodyWords;
+  const int word_count = body_count * kPackedBodyWords;
+  g_packed_bodies.resize(word_count);
+  emscripten::val(
+      emscripten::typed_memory_view(word_count, g_packed_bodies.data()))
+      .call<void>("set", data.call<emscripten::val>("subarray", 0, word_count));
+  unpack_bodies(g_packed_bodies.data(), body_count, g_bodies);
+  g_workspace.accelerations_valid = false;
+}
+
+// Статистика последних шагов и кадров в JSON для оверлея производительности
+std::string getPerformanceProfile() {
+  PerformanceProfile profile;
+#ifdef __EMSCRIPTEN_PTHREADS__
+  {
+    std::lock_guard<std::mutex> lock(g_profile_mutex);
+    profile = g_worker_profile;
+  }
+#else
+  profile = g_workspace.profile;
+#endif
+  profile.render = g_render_times;
+  profile.frame = g_frame_times;
+  return profile.to_json();
+}
+
+bool is_level_of_detail() { return g_level_of_detail; }
+
+void set_level_of_detail(bool level_of_detail) {
+  g_level_of_detail = level_of_detail;
+}
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+// Интерполяция положений между снимками потока физики
+bool is_interpolation() { return g_interpolation; }
+
+void set_interpolation(bool interpolation) { g_interpolation = interpolation; }
+#endif
+
+EMSCRIPTEN_BINDINGS(simulation_module) {
+  emscripten::value_object<SimulationParameters>("SimulationParameters")
+      .field("G", &SimulationParameters::G)
+      .field("DENSITY", &SimulationParameters::DENSITY)
+      .field("NUM_BODIES", &SimulationParameters::NUM_BODIES)
+      .field("INITIALIZATION_RADIUS",
+             &SimulationParameters::INITIALIZATION_RADIUS)
+      .field("DT", &SimulationParameters::DT)
+      .field("SOFTENING_FACTOR", &SimulationParameters::SOFTENING_FACTOR)
+      .field("MAX_MASS", &SimulationParameters::MAX_MASS)
+      .field("MIN_MASS", &SimulationParameters::MIN_MASS)
+      .field("CENTRAL_BODY_MASS", &SimulationParameters::CENTRAL_BODY_MASS)
+      .field("THETA", &SimulationParameters::THETA)
+      .field("NUM_THREADS", &SimulationParameters::NUM_THREADS)
+      .field("SOLVER", &SimulationParameters::SOLVER)
+      .field("FMM_ORDER", &SimulationParameters::FMM_ORDER)
+      .field("INTEGRATOR", &SimulationParameters::INTEGRATOR)
+      .field("TREE_REBUILD_INTERVAL",
+             &SimulationParameters::TREE_REBUILD_INTERVAL)
+      .field("MAX_TIMESTEP_LEVEL", &SimulationParameters::MAX_TIMESTEP_LEVEL)
+      .field("TIMESTEP_ACCURACY", &SimulationParameters::TIMESTEP_ACCURACY)
+      .field("SEED", &SimulationParameters::SEED)
+      .field("DETERMINISTIC", &SimulationParameters::DETERMINISTIC);
+
+  emscripten::function("getSimulationParameters",
+                       emscripten::select_overload<SimulationParameters()>(
+                           []() -> SimulationParameters { return g_params; }));
+
+  emscripten::function("setSimulationParameters",
+                       emscripten::select_overload<void(SimulationParameters)>(
+                           [](SimulationParameters new_params) {
+                             SimulationLock lock;
+                             g_params = new_params;
+                             if (g_renderer) {
+                               g_renderer->set_initialization_radius(
+                                   new_params.INITIALIZATION_RADIUS);
+                               g_renderer->reset_view();
+                             }
+                             reset_simulation();
+                           }));
+
+  emscripten::function("resetSimulationToDefaults",
+                       &reset_simulation_to_defaults);
+  emscripten::function("resetSimulation", &restart_simulation);
+  emscripten::function("isStateLoaded", &isStateLoaded);
+  emscripten::function("markStateAsLoaded", &markStateAsLoaded);
+  emscripten::function("getSimulationSpeed", &get_simulation_speed);
+  emscripten::function("increaseSimulationSpeed", &increase_simulation_speed);
+  emscripten::function("decreaseSimulationSpeed", &decrease_simulation_speed);
+  emscripten::function("isAdaptiveSpeed", &is_adaptive_speed);
+  emscripten::function("setAdaptiveSpeed", &set_adaptive_speed);
+  emscripten::function("setFrameBudget", &set_frame_budget);
+  emscripten::function("setColors", &set_colors);
+  emscripten::function("getBodyData", &getBodyData);
+  emscripten::function("setBodyData", &setBodyData);
+  emscripten::function("getPerformanceProfile", &getPerformanceProfile);
+  emscripten::function("isLevelOfDetail", &is_level_of_detail);
+  emscripten::function("setLevelOfDetail", &set_level_of_detail);
+#ifdef __EMSCRIPTEN_PTHREADS__
+  emscripten::function("isInterpolation", &is_interpolation);
+  emscripten::function("setInterpolation", &set_interpolation);
+#endif
+}
+#endif
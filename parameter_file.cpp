@@ -0,0 +1,116 @@
+#include "parameter_file.h"
+
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+struct ParameterField {
+  const char* name;
+  float SimulationParameters::*float_field;
+  int SimulationParameters::*int_field;
+};
+
+const ParameterField kParameterFields[] = {
+    {"G", &SimulationParameters::G, nullptr},
+    {"DENSITY", &SimulationParameters::DENSITY, nullptr},
+    {"NUM_BODIES", nullptr, &SimulationParameters::NUM_BODIES},
+    {"INITIALIZATION_RADIUS", &SimulationParameters::INITIALIZATION_RADIUS,
+     nullptr},
+    {"DT", &SimulationParameters::DT, nullptr},
+    {"SOFTENING_FACTOR", &SimulationParameters::SOFTENING_FACTOR, nullptr},
+    {"MAX_MASS", &SimulationParameters::MAX_MASS, nullptr},
+    {"MIN_MASS", &SimulationParameters::MIN_MASS, nullptr},
+    {"CENTRAL_BODY_MASS", &SimulationParameters::CENTRAL_BODY_MASS, nullptr},
+    {"THETA", &SimulationParameters::THETA, nullptr},
+    {"NUM_THREADS", nullptr, &SimulationParameters::NUM_THREADS},
+    {"SOLVER", nullptr, &SimulationParameters::SOLVER},
+    {"FMM_ORDER", nullptr, &SimulationParameters::FMM_ORDER},
+    {"INTEGRATOR", nullptr, &SimulationParameters::INTEGRATOR},
+    {"TREE_REBUILD_INTERVAL", nullptr,
+     &SimulationParameters::TREE_REBUILD_INTERVAL},
+    {"MAX_TIMESTEP_LEVEL", nullptr,
+     &SimulationParameters::MAX_TIMESTEP_LEVEL},
+    {"TIMESTEP_ACCURACY", &SimulationParameters::TIMESTEP_ACCURACY, nullptr},
+    {"SEED", nullptr, &SimulationParameters::SEED},
+    {"DETERMINISTIC", nullptr, &SimulationParameters::DETERMINISTIC},
+};
+
+std::string trim(const std::string& text) {
+  const char* whitespace = " \t\r\n";
+  size_t begin = text.find_first_not_of(whitespace);
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = text.find_last_not_of(whitespace);
+  return text.substr(begin, end - begin + 1);
+}
+
+}  // namespace
+
+bool set_parameter(SimulationParameters& params, const std::string& name,
+                   const std::string& value) {
+  for (const ParameterField& field : kParameterFields) {
+    if (name != field.name) {
+      continue;
+    }
+    std::istringstream stream(value);
+    if (field.float_field) {
+      stream >> params.*field.float_field;
+    } else {
+      stream >> params.*field.int_field;
+    }
+    return !stream.fail() && stream.eof();
+  }
+  return false;
+}
+
+bool read_parameters(std::istream& stream, const std::string& source,
+                     SimulationParameters& params) {
+  std::string line;
+  int line_number = 0;
+  while (std::getline(stream, line)) {
+    ++line_number;
+    line = trim(line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t separator = line.find('=');
+    if (separator == std::string::npos ||
+        !set_parameter(params, trim(line.substr(0, separator)),
+                       trim(line.substr(separator + 1)))) {
+      std::cerr << source << ":" << line_number
+                << ": invalid parameter line: " << line << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool load_parameter_file(const std::string& path,
+                         SimulationParameters& params) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open parameter file: " << path << std::endl;
+    return false;
+  }
+  return read_parameters(file, path, params);
+}
+
+std::string format_parameters(const SimulationParameters& params) {
+  std::ostringstream stream;
+  // Точности хватает, чтобы float прочитался обратно без изменений
+  stream.precision(std::numeric_limits<float>::max_digits10);
+  for (const ParameterField& field : kParameterFields) {
+    stream << field.name << " = ";
+    if (field.float_field) {
+      stream << params.*field.float_field;
+    } else {
+      stream << params.*field.int_field;
+    }
+    stream << "\n";
+  }
+  return stream.str();
+}
@@ -0,0 +1,24 @@
+#ifndef PARAMETER_FILE_H
+#define PARAMETER_FILE_H
+
+#include <istream>
+#include <string>
+
+#include "simulation.h"
+
+// Читает параметры симуляции из текстового файла со строками вида
+// "ИМЯ = значение". Пустые строки и строки, начинающиеся с '#', пропускаются,
+// не упомянутые в файле параметры остаются прежними. Об ошибках сообщает в
+// std::cerr и возвращает false.
+bool load_parameter_file(const std::string& path, SimulationParameters& params);
+// То же для потока; source называет его в сообщениях об ошибках
+bool read_parameters(std::istream& stream, const std::string& source,
+                     SimulationParameters& params);
+// Все параметры в формате файла параметров, по строке на параметр
+std::string format_parameters(const SimulationParameters& params);
+
+// Устанавливает параметр по имени
+bool set_parameter(SimulationParameters& params, const std::string& name,
+                   const std::string& value);
+
+#endif  // PARAMETER_FILE_H
@@ -0,0 +1,21 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// Точность вычислений выбирается при сборке (SOLAR_SIM_PRECISION в CMake или
+// build.sh):
+//   float  — всё в float (по умолчанию);
+//   double — всё в double, ядра сил скалярные;
+//   mixed  — положения, скорости и моменты узлов в double, а попарные ядра
+//            сил остаются векторными в float.
+#if defined(SOLAR_SIM_PRECISION_DOUBLE)
+typedef double Real;        // состояние тел и суммы моментов
+typedef double KernelReal;  // массивы SoA и ядра попарных сил
+#elif defined(SOLAR_SIM_PRECISION_MIXED)
+typedef double Real;
+typedef float KernelReal;
+#else
+typedef float Real;
+typedef float KernelReal;
+#endif
+
+#endif  // PRECISION_H
@@ -0,0 +1,136 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+const char* get_phase_name(int phase) {
+  switch (phase) {
+    case PHASE_BUILD:
+      return "build";
+    case PHASE_COLLIDE:
+      return "collide";
+    case PHASE_MASS_DISTRIBUTION:
+      return "mass";
+    case PHASE_FORCE:
+      return "force";
+    case PHASE_INTEGRATE:
+      return "integrate";
+  }
+  return "unknown";
+}
+
+const char* get_counter_name(int counter) {
+  switch (counter) {
+    case COUNTER_FORCE_BODIES:
+      return "force_bodies";
+    case COUNTER_NODE_VISITS:
+      return "node_visits";
+    case COUNTER_INTERACTIONS:
+      return "interactions";
+    case COUNTER_TREE_DEPTH:
+      return "tree_depth";
+    case COUNTER_PAIR_TESTS:
+      return "pair_tests";
+    case COUNTER_MERGES:
+      return "merges";
+  }
+  return "unknown";
+}
+
+double RollingHistogram::mean() const {
+  if (count_ == 0) {
+    return 0.0;
+  }
+  double sum = 0.0;
+  for (int i = 0; i < count_; ++i) {
+    sum += samples_[i];
+  }
+  return sum / count_;
+}
+
+int64_t RollingHistogram::percentile(double fraction) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  int64_t sorted[kProfileWindow];
+  std::copy(samples_, samples_ + count_, sorted);
+  int k = static_cast<int>(fraction * (count_ - 1) + 0.5);
+  k = std::min(std::max(k, 0), count_ - 1);
+  std::nth_element(sorted, sorted + k, sorted + count_);
+  return sorted[k];
+}
+
+int64_t RollingHistogram::max() const {
+  if (count_ == 0) {
+    return 0;
+  }
+  return *std::max_element(samples_, samples_ + count_);
+}
+
+void RollingHistogram::fill_buckets(int buckets[kHistogramBuckets]) const {
+  std::fill(buckets, buckets + kHistogramBuckets, 0);
+  for (int i = 0; i < count_; ++i) {
+    int bucket = 0;
+    for (uint64_t value = std::max<int64_t>(samples_[i], 0); value > 0;
+         value >>= 1) {
+      ++bucket;
+    }
+    ++buckets[std::min(bucket, kHistogramBuckets - 1)];
+  }
+}
+
+void PerformanceProfile::add_step(const PhaseTimes& before,
+                                  const PhaseTimes& after,
+                                  const StepCounters& step_counters) {
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    phases[phase].add(after.nanoseconds[phase] - before.nanoseconds[phase]);
+  }
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+    counters[counter].add(step_counters.values[counter]);
+  }
+}
+
+namespace {
+
+void append_histogram(std::string& json, const char* name,
+                      const RollingHistogram& histogram) {
+  if (histogram.count() == 0) {
+    return;
+  }
+  char buffer[256];
+  std::snprintf(buffer, sizeof(buffer),
+                "%s\"%s\":{\"count\":%d,\"mean\":%.1f,\"p50\":%lld,"
+                "\"p95\":%lld,\"max\":%lld,\"buckets\":[",
+                json.back() == '{' ? "" : ",", name, histogram.count(),
+                histogram.mean(),
+                static_cast<long long>(histogram.percentile(0.5)),
+                static_cast<long long>(histogram.percentile(0.95)),
+                static_cast<long long>(histogram.max()));
+  json += buffer;
+  int buckets[kHistogramBuckets];
+  histogram.fill_buckets(buckets);
+  for (int k = 0; k < kHistogramBuckets; ++k) {
+    if (k > 0) json += ',';
+    json += std::to_string(buckets[k]);
+  }
+  json += "]}";
+}
+
+}  // namespace
+
+std::string PerformanceProfile::to_json() const {
+  // Времена в наносекундах, счётчики — значения за шаг
+  std::string json = "{\"phases\":{";
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    append_histogram(json, get_phase_name(phase), phases[phase]);
+  }
+  json += "},\"frame\":{";
+  append_histogram(json, "render", render);
+  append_histogram(json, "total", frame);
+  json += "},\"counters\":{";
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+    append_histogram(json, get_counter_name(counter), counters[counter]);
+  }
+  json += "}}";
+  return json;
+}
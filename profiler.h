@@ -0,0 +1,137 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Этапы шага симуляции
+enum SimulationPhase {
+  PHASE_BUILD = 0,          // построение квадродерева
+  PHASE_COLLIDE,            // столкновения и удаление слившихся тел
+  PHASE_MASS_DISTRIBUTION,  // массы и моменты узлов
+  PHASE_FORCE,              // ускорения
+  PHASE_INTEGRATE,          // скорости и положения
+  PHASE_COUNT,
+};
+
+const char* get_phase_name(int phase);
+
+// Счётчики работы за шаг симуляции
+enum ProfileCounter {
+  COUNTER_FORCE_BODIES = 0,  // тел, получивших силы обходом дерева
+  COUNTER_NODE_VISITS,       // узлов, просмотренных при обходах дерева
+  COUNTER_INTERACTIONS,      // слагаемых сил (тел и узлов) по всем телам
+  COUNTER_TREE_DEPTH,        // глубина дерева
+  COUNTER_PAIR_TESTS,        // пар тел, проверенных на столкновение
+  COUNTER_MERGES,            // слияний тел
+  COUNTER_COUNT,
+};
+
+const char* get_counter_name(int counter);
+
+// Суммарное время этапов за несколько шагов
+struct PhaseTimes {
+  int64_t nanoseconds[PHASE_COUNT] = {};
+  int64_t step_count = 0;
+
+  void clear() { *this = PhaseTimes(); }
+};
+
+// Значения счётчиков за текущий шаг
+struct StepCounters {
+  int64_t values[COUNTER_COUNT] = {};
+
+  void clear() { *this = StepCounters(); }
+};
+
+// Замеров в скользящем окне и корзин гистограммы
+constexpr int kProfileWindow = 128;
+constexpr int kHistogramBuckets = 32;
+
+// Последние kProfileWindow замеров величины в кольцевом буфере. Память не
+// выделяется, статистика считается по запросу.
+class RollingHistogram {
+ public:
+  void add(int64_t value) {
+    samples_[next_] = value;
+    next_ = (next_ + 1) % kProfileWindow;
+    if (count_ < kProfileWindow) ++count_;
+  }
+
+  int count() const { return count_; }
+  double mean() const;
+  // Значение, которое не превышает доля fraction замеров (0.5 — медиана)
+  int64_t percentile(double fraction) const;
+  int64_t max() const;
+  // Число замеров по корзинам степеней двойки: в корзине k > 0 значения из
+  // [2^(k-1), 2^k), в корзине 0 — нули, в последней — всё, что больше
+  void fill_buckets(int buckets[kHistogramBuckets]) const;
+
+ private:
+  int64_t samples_[kProfileWindow] = {};
+  int next_ = 0;
+  int count_ = 0;
+};
+
+// Скользящая статистика шагов симуляции и кадров для оверлея и выгрузки в
+// JSON
+struct PerformanceProfile {
+  RollingHistogram phases[PHASE_COUNT];      // нс на шаг по этапам
+  RollingHistogram counters[COUNTER_COUNT];  // значения счётчиков за шаг
+  RollingHistogram render;                   // нс на отрисовку кадра
+  RollingHistogram frame;                    // нс на кадр целиком
+
+  // Добавляет шаг: время этапов — разница накопленных времён до и после него
+  void add_step(const PhaseTimes& before, const PhaseTimes& after,
+                const StepCounters& step_counters);
+  // Для каждой величины с замерами: среднее, медиана, 95-й процентиль,
+  // максимум и корзины гистограммы
+  std::string to_json() const;
+};
+
+// Добавляет время своей жизни к этапу
+class ScopedPhase {
+ public:
+  ScopedPhase(PhaseTimes& times, SimulationPhase phase)
+      : times_(times),
+        phase_(phase),
+        start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedPhase() {
+    times_.nanoseconds[phase_] +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count();
+  }
+
+  ScopedPhase(const ScopedPhase&) = delete;
+  ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+ private:
+  PhaseTimes& times_;
+  SimulationPhase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Добавляет время своей жизни замером в гистограмму
+class ScopedSample {
+ public:
+  explicit ScopedSample(RollingHistogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedSample() {
+    histogram_.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count());
+  }
+
+  ScopedSample(const ScopedSample&) = delete;
+  ScopedSample& operator=(const ScopedSample&) = delete;
+
+ private:
+  RollingHistogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif  // PROFILER_H
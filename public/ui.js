@@ -1,5 +1,29 @@
 const fullscreenBtn = document.getElementById('fullscreen-btn');
 
+// Number of 32-bit words per body in Module.getBodyData()
+const BODY_WORDS = 7;
+const BODY_MASS_WORD = 4;
+
+// Keeps the maxBodies heaviest bodies of packed body data
+function selectLargestBodies(bodies, maxBodies) {
+  const numBodies = bodies.length / BODY_WORDS;
+  const order = new Uint32Array(numBodies);
+  for (let i = 0; i < numBodies; i++) {
+    order[i] = i;
+  }
+  order.sort(
+    (a, b) =>
+      bodies[b * BODY_WORDS + BODY_MASS_WORD] -
+      bodies[a * BODY_WORDS + BODY_MASS_WORD]
+  );
+  const selected = new Float32Array(maxBodies * BODY_WORDS);
+  for (let i = 0; i < maxBodies; i++) {
+    const start = order[i] * BODY_WORDS;
+    selected.set(bodies.subarray(start, start + BODY_WORDS), i * BODY_WORDS);
+  }
+  return selected;
+}
+
 function encodeSimulationData(data) {
   let buffer = new ArrayBuffer(1024); // Start with a 1KB buffer
   let view = new DataView(buffer);
@@ -7,7 +31,11 @@ function encodeSimulationData(data) {
 
   function ensureCapacity(needed) {
     if (buffer.byteLength < offset + needed) {
-      const newBuffer = new ArrayBuffer(buffer.byteLength * 2);
+      let newSize = buffer.byteLength * 2;
+      while (newSize < offset + needed) {
+        newSize *= 2;
+      }
+      const newBuffer = new ArrayBuffer(newSize);
       new Uint8Array(newBuffer).set(new Uint8Array(buffer));
       buffer = newBuffer;
       view = new DataView(buffer);
@@ -21,27 +49,20 @@ function encodeSimulationData(data) {
     offset += 4;
   }
 
-  // Encode bodies
-  ensureCapacity(4);
-  view.setUint32(offset, data.bodies.length, true);
+  // Encode bodies: packed records of 7 little-endian 32-bit words
+  // {x, y, vx, vy, mass, id, radius} copied as a whole
+  const numBodies = data.bodies.length / BODY_WORDS;
+  ensureCapacity(4 + data.bodies.byteLength);
+  view.setUint32(offset, numBodies, true);
   offset += 4;
-  for (const body of data.bodies) {
-    ensureCapacity(28); // 6 floats + 1 int per body
-    view.setFloat32(offset, body.x, true);
-    offset += 4;
-    view.setFloat32(offset, body.y, true);
-    offset += 4;
-    view.setFloat32(offset, body.vx, true);
-    offset += 4;
-    view.setFloat32(offset, body.vy, true);
-    offset += 4;
-    view.setFloat32(offset, body.mass, true);
-    offset += 4;
-    view.setInt32(offset, body.id, true);
-    offset += 4;
-    view.setFloat32(offset, body.radius, true);
-    offset += 4;
-  }
+  new Uint8Array(buffer, offset, data.bodies.byteLength).set(
+    new Uint8Array(
+      data.bodies.buffer,
+      data.bodies.byteOffset,
+      data.bodies.byteLength
+    )
+  );
+  offset += data.bodies.byteLength;
 
   // Encode colors
   ensureCapacity(4);
@@ -86,7 +107,7 @@ function decodeSimulationData(encodedData) {
   let offset = 0;
   const data = {
     parameters: {},
-    bodies: [],
+    bodies: null,
     colors: [],
   };
 
@@ -99,24 +120,9 @@ function decodeSimulationData(encodedData) {
   // Decode bodies
   const numBodies = view.getUint32(offset, true);
   offset += 4;
-  for (let i = 0; i < numBodies; i++) {
-    const body = {};
-    body.x = view.getFloat32(offset, true);
-    offset += 4;
-    body.y = view.getFloat32(offset, true);
-    offset += 4;
-    body.vx = view.getFloat32(offset, true);
-    offset += 4;
-    body.vy = view.getFloat32(offset, true);
-    offset += 4;
-    body.mass = view.getFloat32(offset, true);
-    offset += 4;
-    body.id = view.getInt32(offset, true);
-    offset += 4;
-    body.radius = view.getFloat32(offset, true);
-    offset += 4;
-    data.bodies.push(body);
-  }
+  const bodiesSize = numBodies * BODY_WORDS * 4;
+  data.bodies = new Float32Array(buffer.slice(offset, offset + bodiesSize));
+  offset += bodiesSize;
 
   // Decode colors
   const numColors = view.getUint32(offset, true);
@@ -147,8 +153,16 @@ const form = document.getElementById('settings-form');
 const decreaseSpeedBtn = document.getElementById('decrease-speed-btn');
 const increaseSpeedBtn = document.getElementById('increase-speed-btn');
 const simulationSpeedEl = document.getElementById('simulation-speed');
+const autoSpeedBtn = document.getElementById('auto-speed-btn');
 const colorStopsContainer = document.getElementById('color-stops');
 const addColorStopBtn = document.getElementById('add-color-stop-btn');
+const performanceOverlay = document.getElementById('performance-overlay');
+const performanceOverlayToggle = document.getElementById(
+  'performance-overlay-toggle'
+);
+const levelOfDetailToggle = document.getElementById('level-of-detail-toggle');
+const interpolationRow = document.getElementById('interpolation-row');
+const interpolationToggle = document.getElementById('interpolation-toggle');
 let wasmReady = false;
 
 const defaultColorStops = [
@@ -230,23 +244,135 @@ function applyColors() {
   Module.setColors(colors, weights);
 }
 
+// В адаптивном режиме число шагов на кадр меняется само, поэтому
+// показываемое значение обновляется по таймеру
+const SPEED_UPDATE_INTERVAL_MS = 500;
+let speedUpdateTimer = null;
+
 function updateSimulationSpeed() {
   if (!wasmReady) return;
+  const adaptive = Module.isAdaptiveSpeed();
   simulationSpeedEl.textContent = Module.getSimulationSpeed();
+  autoSpeedBtn.classList.toggle('active', adaptive);
+  if (adaptive && speedUpdateTimer === null) {
+    speedUpdateTimer = setInterval(
+      updateSimulationSpeed,
+      SPEED_UPDATE_INTERVAL_MS
+    );
+  } else if (!adaptive && speedUpdateTimer !== null) {
+    clearInterval(speedUpdateTimer);
+    speedUpdateTimer = null;
+  }
+}
+
+function setAdaptiveSpeed(adaptive) {
+  Module.setAdaptiveSpeed(adaptive);
+  localStorage.setItem('adaptiveSpeed', adaptive ? '1' : '0');
+  updateSimulationSpeed();
 }
 
 decreaseSpeedBtn.addEventListener('click', () => {
   if (!wasmReady) return;
   Module.decreaseSimulationSpeed();
+  localStorage.setItem('adaptiveSpeed', '0');
   updateSimulationSpeed();
 });
 
 increaseSpeedBtn.addEventListener('click', () => {
   if (!wasmReady) return;
   Module.increaseSimulationSpeed();
+  localStorage.setItem('adaptiveSpeed', '0');
   updateSimulationSpeed();
 });
 
+autoSpeedBtn.addEventListener('click', () => {
+  if (!wasmReady) return;
+  setAdaptiveSpeed(!Module.isAdaptiveSpeed());
+});
+
+// Оверлей производительности: время этапов шага и кадра в миллисекундах
+// (среднее, медиана, 95-й процентиль, максимум за последние шаги) и счётчики
+const PERFORMANCE_OVERLAY_INTERVAL_MS = 500;
+let performanceOverlayTimer = null;
+
+function formatTimings(name, histogram) {
+  const ms = (ns) => (ns / 1e6).toFixed(2).padStart(7);
+  return (
+    name.padEnd(10) +
+    ms(histogram.mean) +
+    ms(histogram.p50) +
+    ms(histogram.p95) +
+    ms(histogram.max)
+  );
+}
+
+function updatePerformanceOverlay() {
+  if (!wasmReady) return;
+  const profile = JSON.parse(Module.getPerformanceProfile());
+  const lines = [`${'ms'.padEnd(10)}   mean    p50    p95    max`];
+  for (const [name, histogram] of Object.entries(profile.phases)) {
+    lines.push(formatTimings(name, histogram));
+  }
+  for (const [name, histogram] of Object.entries(profile.frame)) {
+    lines.push(formatTimings(name, histogram));
+  }
+
+  const counters = profile.counters;
+  const perBody = (counter) =>
+    counters.force_bodies.mean > 0
+      ? (counters[counter].mean / counters.force_bodies.mean).toFixed(1)
+      : '-';
+  if (counters.force_bodies) {
+    lines.push(
+      '',
+      `node visits/body   ${perBody('node_visits')}`,
+      `interactions/body  ${perBody('interactions')}`,
+      `tree depth         ${counters.tree_depth.max}`,
+      `pair tests/step    ${Math.round(counters.pair_tests.mean)}`,
+      `merges/step        ${counters.merges.mean.toFixed(1)}`
+    );
+  }
+  performanceOverlay.textContent = lines.join('\n');
+}
+
+function setPerformanceOverlayVisible(visible) {
+  performanceOverlayToggle.checked = visible;
+  performanceOverlay.classList.toggle('hidden', !visible);
+  clearInterval(performanceOverlayTimer);
+  performanceOverlayTimer = visible
+    ? setInterval(updatePerformanceOverlay, PERFORMANCE_OVERLAY_INTERVAL_MS)
+    : null;
+  localStorage.setItem('performanceOverlay', visible ? '1' : '0');
+}
+
+performanceOverlayToggle.addEventListener('change', () => {
+  setPerformanceOverlayVisible(performanceOverlayToggle.checked);
+});
+
+// Тела в узлах дерева меньше пикселя рисуются одной точкой
+function setLevelOfDetail(enabled) {
+  Module.setLevelOfDetail(enabled);
+  levelOfDetailToggle.checked = enabled;
+  localStorage.setItem('levelOfDetail', enabled ? '1' : '0');
+}
+
+levelOfDetailToggle.addEventListener('change', () => {
+  setLevelOfDetail(levelOfDetailToggle.checked);
+});
+
+// Интерполяция между снимками есть только в многопоточной сборке, где физика
+// шагает в отдельном потоке
+function setInterpolation(enabled) {
+  if (!Module.setInterpolation) return;
+  Module.setInterpolation(enabled);
+  interpolationToggle.checked = enabled;
+  localStorage.setItem('interpolation', enabled ? '1' : '0');
+}
+
+interpolationToggle.addEventListener('change', () => {
+  setInterpolation(interpolationToggle.checked);
+});
+
 const simulationParameterKeys = [
   'G',
   'DENSITY',
@@ -260,11 +386,34 @@ const simulationParameterKeys = [
   'THETA',
 ];
 
+// Параметры производительности и зерно: сохраняются в настройках, но не
+// попадают в ссылку. Первые не влияют на состояние симуляции, а зерно нужно
+// только для начальных тел, которые ссылка несёт сама.
+const performanceParameterKeys = [
+  'SEED',
+  'NUM_THREADS',
+  'SOLVER',
+  'FMM_ORDER',
+  'INTEGRATOR',
+  'TREE_REBUILD_INTERVAL',
+  'MAX_TIMESTEP_LEVEL',
+  'TIMESTEP_ACCURACY',
+];
+
+const settingsFormKeys = [
+  ...simulationParameterKeys,
+  ...performanceParameterKeys,
+];
+
+function withCurrentParameters(params) {
+  return Object.assign(Module.getSimulationParameters(), params);
+}
+
 function populateSettingsForm() {
   if (!wasmReady) return;
   updateSimulationSpeed();
   const params = Module.getSimulationParameters();
-  for (const key of simulationParameterKeys) {
+  for (const key of settingsFormKeys) {
     if (form.elements[key] && params.hasOwnProperty(key)) {
       const value = params[key];
       if (form.elements[key].step === 'any') {
@@ -278,7 +427,7 @@ function populateSettingsForm() {
 
 function saveSettings() {
   const settings = {};
-  for (const key of simulationParameterKeys) {
+  for (const key of settingsFormKeys) {
     if (form.elements[key]) {
       settings[key] = form.elements[key].value;
     }
@@ -295,24 +444,24 @@ function loadSettings() {
       colorStops = settings.colorStops;
     }
     const newParams = {};
-    for (const key of simulationParameterKeys) {
+    for (const key of settingsFormKeys) {
       if (settings.hasOwnProperty(key)) {
         newParams[key] = Number(settings[key]) || 0;
       }
     }
-    Module.setSimulationParameters(newParams);
+    Module.setSimulationParameters(withCurrentParameters(newParams));
   }
 }
 
 function applySettings() {
   if (!wasmReady) return;
   const newParams = {};
-  for (const key of simulationParameterKeys) {
+  for (const key of settingsFormKeys) {
     if (form.elements[key]) {
       newParams[key] = Number(form.elements[key].value) || 0;
     }
   }
-  Module.setSimulationParameters(newParams);
+  Module.setSimulationParameters(withCurrentParameters(newParams));
   applyColors();
   saveSettings();
   settingsPanel.classList.add('hidden');
@@ -355,23 +504,22 @@ shareBtn.addEventListener('click', () => {
   const MAX_BINARY_SIZE = Math.floor((MAX_BASE64_LENGTH * 3) / 4);
 
   const parameters = Module.getSimulationParameters();
-  let bodies = Module.getBodies();
+  // The view into WASM memory is copied right away
+  let bodies = Module.getBodyData().slice();
   const colors = colorStops;
 
   const paramSize = simulationParameterKeys.length * 4;
   const colorsSize = 4 + colors.length * 7;
   const fixedSize = paramSize + 4 /* num_bodies */ + colorsSize;
 
-  const maxBodies = Math.floor((MAX_BINARY_SIZE - fixedSize) / 28);
+  const maxBodies = Math.floor((MAX_BINARY_SIZE - fixedSize) / (BODY_WORDS * 4));
 
-  if (bodies.length > maxBodies) {
+  if (bodies.length / BODY_WORDS > maxBodies) {
     alert(
       `Warning: The simulation contains too many bodies to share in a URL. Only the ${maxBodies} largest bodies will be included in the sharable link.`
     );
 
-    bodies.sort((a, b) => b.mass - a.mass);
-
-    bodies = bodies.slice(0, maxBodies);
+    bodies = selectLargestBodies(bodies, maxBodies);
   }
 
   const simulationData = {
@@ -449,10 +597,12 @@ var Module = {
         const parsedData = decodeSimulationData(simulationData);
 
         if (parsedData.parameters) {
-          Module.setSimulationParameters(parsedData.parameters);
+          Module.setSimulationParameters(
+            withCurrentParameters(parsedData.parameters)
+          );
         }
         if (parsedData.bodies) {
-          Module.setBodies(parsedData.bodies);
+          Module.setBodyData(parsedData.bodies);
           Module.markStateAsLoaded();
         }
         if (parsedData.colors) {
@@ -469,6 +619,15 @@ var Module = {
     populateSettingsForm();
     renderColorStops();
     applyColors();
+    setPerformanceOverlayVisible(
+      localStorage.getItem('performanceOverlay') === '1'
+    );
+    setAdaptiveSpeed(localStorage.getItem('adaptiveSpeed') === '1');
+    setLevelOfDetail(localStorage.getItem('levelOfDetail') !== '0');
+    if (Module.setInterpolation) {
+      interpolationRow.hidden = false;
+      setInterpolation(localStorage.getItem('interpolation') !== '0');
+    }
   },
 };
 
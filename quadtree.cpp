@@ -1,62 +1,698 @@
 #include "quadtree.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "gravity_kernels.h"
 #include "simulation.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Число разрядов ключа Мортона на координату и глубина дерева при построении
+constexpr int kMortonBits = 16;
+constexpr float kMortonCells = static_cast<float>(1 << kMortonBits);
+
+// Раздвигает биты 16-битного числа, вставляя нулевой бит между соседними
+uint32_t spread_bits(uint32_t v) {
+  v &= 0x0000FFFF;
+  v = (v | (v << 8)) & 0x00FF00FF;
+  v = (v | (v << 4)) & 0x0F0F0F0F;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+// Младший бит пары — x, старший — y, что совпадает с порядком потомков узла
+uint32_t morton_key(uint32_t x, uint32_t y) {
+  return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+// Наибольшее число тел в группе, вместе обходящей дерево при расчёте сил
+constexpr int kForceGroupSize = 32;
+// Количество групп в блоке при параллельном расчёте сил
+constexpr int kForceGroupChunk = 8;
+
+// Тел дерева на задачу при учёте тел вне корня
+constexpr int kOverflowChunk = 1024;
+
+// Тел в блоке при подсчёте границ корня
+constexpr int kBoundsBlockSize = 4096;
+
+// Тел в блоке при вычислении ключей Мортона и поразрядной сортировке. Блоки
+// фиксированного размера обрабатываются параллельно, а их счётчики
+// складываются по порядку, поэтому порядок тел не зависит от числа потоков.
+constexpr int kSortBlockSize = 16384;
+// build() строит последовательно только верхнюю часть дерева: узел, в котором
+// не больше max(kMinSubtreeBodies, N / kSubtreeTarget) тел, становится корнем
+// поддерева, которое строится отдельной задачей
+constexpr int kSubtreeTarget = 64;
+constexpr int kMinSubtreeBodies = 2048;
+
+// Пределы, после которых refit() отказывается обновлять дерево: доля тел,
+// сменивших лист, и заполнение листа относительно вместимости
+constexpr float kRefitMaxMovedFraction = 0.1f;
+constexpr int kRefitMaxLeafFactor = 4;
+
+// Список взаимодействий группы в формате SoA. У каждого потока свой список,
+// память которого переиспользуется между шагами.
+struct InteractionList {
+  // Тела ближних узлов
+  AlignedVector<KernelReal> x;
+  AlignedVector<KernelReal> y;
+  AlignedVector<KernelReal> mass;
+  // Далёкие узлы с квадрупольными моментами
+  AlignedVector<KernelReal> node_x;
+  AlignedVector<KernelReal> node_y;
+  AlignedVector<KernelReal> node_mass;
+  AlignedVector<KernelReal> node_xx;
+  AlignedVector<KernelReal> node_xy;
+  AlignedVector<KernelReal> node_yy;
+  std::vector<int> targets;
+
+  void clear() {
+    x.clear();
+    y.clear();
+    mass.clear();
+    node_x.clear();
+    node_y.clear();
+    node_mass.clear();
+    node_xx.clear();
+    node_xy.clear();
+    node_yy.clear();
+    targets.clear();
+  }
+
+  void add(KernelReal source_x, KernelReal source_y, KernelReal source_mass) {
+    x.push_back(source_x);
+    y.push_back(source_y);
+    mass.push_back(source_mass);
+  }
+
+  void add(const QuadtreeNode& node) {
+    node_x.push_back(node.center_of_mass_x);
+    node_y.push_back(node.center_of_mass_y);
+    node_mass.push_back(node.total_mass);
+    node_xx.push_back(node.quadrupole_xx);
+    node_xy.push_back(node.quadrupole_xy);
+    node_yy.push_back(node.quadrupole_yy);
+  }
+};
+
+uint32_t quantize(float value, float min_value, float scale) {
+  float cell = (value - min_value) * scale;
+  if (cell < 0.0f) return 0;
+  if (cell >= kMortonCells) return (1u << kMortonBits) - 1;
+  return static_cast<uint32_t>(cell);
+}
+
+// Делит узел на четыре квадранта, добавляя потомков в конец nodes
+void subdivide(std::vector<QuadtreeNode>& nodes, int node_index) {
+  Boundary boundary = nodes[node_index].boundary;
+  float x = boundary.x;
+  float y = boundary.y;
+  float hd = boundary.half_dim / 2.0f;
+
+  // Узлы добавляются подряд, поэтому достаточно запомнить первого потомка
+  const int first_child = static_cast<int>(nodes.size());
+  const Boundary children[4] = {
+      {x - hd, y - hd, hd},  // северо-запад
+      {x + hd, y - hd, hd},  // северо-восток
+      {x - hd, y + hd, hd},  // юго-запад
+      {x + hd, y + hd, hd},  // юго-восток
+  };
+  for (const Boundary& child : children) {
+    QuadtreeNode node;
+    node.boundary = child;
+    nodes.push_back(node);
+  }
+  nodes[node_index].first_child = first_child;
+}
+
+bool contains(const Boundary& boundary, const CelestialBody& body) {
+  return body.x >= boundary.x - boundary.half_dim &&
+         body.x <= boundary.x + boundary.half_dim &&
+         body.y >= boundary.y - boundary.half_dim &&
+         body.y <= boundary.y + boundary.half_dim;
+}
+
+}  // namespace
 
 Quadtree::Quadtree(const Boundary& boundary, int capacity)
-    : boundary_(boundary), capacity_(capacity) {}
+    : boundary_(boundary), capacity_(capacity) {
+  add_node(boundary_);
+}
+
+int Quadtree::add_node(const Boundary& boundary) {
+  QuadtreeNode node;
+  node.boundary = boundary;
+  nodes_.push_back(node);
+  return static_cast<int>(nodes_.size()) - 1;
+}
+
+void Quadtree::fit_boundary(const std::vector<CelestialBody>& bodies,
+                            ThreadPool& pool) {
+  const int count = static_cast<int>(bodies.size());
+  if (count == 0) {
+    return;
+  }
+  constexpr Real kMaxReal = std::numeric_limits<Real>::max();
+
+  // 1. Суммы и крайние координаты по блокам. Блоки фиксированного размера
+  // складываются по порядку, поэтому результат не зависит от числа потоков.
+  const int block_count = (count + kBoundsBlockSize - 1) / kBoundsBlockSize;
+  bounds_blocks_.resize(block_count);
+  pool.parallel_for(block_count, 1, [&](int begin, int end) {
+    for (int block = begin; block < end; ++block) {
+      BoundsBlock result = {0.0, 0.0, 0.0, kMaxReal, -kMaxReal, kMaxReal,
+                            -kMaxReal};
+      const int last = std::min(count, (block + 1) * kBoundsBlockSize);
+      for (int i = block * kBoundsBlockSize; i < last; ++i) {
+        const CelestialBody& body = bodies[i];
+        result.sum_x += body.x;
+        result.sum_y += body.y;
+        result.min_x = std::min(result.min_x, body.x);
+        result.max_x = std::max(result.max_x, body.x);
+        result.min_y = std::min(result.min_y, body.y);
+        result.max_y = std::max(result.max_y, body.y);
+      }
+      bounds_blocks_[block] = result;
+    }
+  });
+  BoundsBlock total = bounds_blocks_[0];
+  for (int block = 1; block < block_count; ++block) {
+    const BoundsBlock& part = bounds_blocks_[block];
+    total.sum_x += part.sum_x;
+    total.sum_y += part.sum_y;
+    total.min_x = std::min(total.min_x, part.min_x);
+    total.max_x = std::max(total.max_x, part.max_x);
+    total.min_y = std::min(total.min_y, part.min_y);
+    total.max_y = std::max(total.max_y, part.max_y);
+  }
+  const double center_x = total.sum_x / count;
+  const double center_y = total.sum_y / count;
+
+  // 2. Сумма расстояний от среднего положения тем же разбиением на блоки
+  pool.parallel_for(block_count, 1, [&](int begin, int end) {
+    for (int block = begin; block < end; ++block) {
+      double sum_distance = 0.0;
+      const int last = std::min(count, (block + 1) * kBoundsBlockSize);
+      for (int i = block * kBoundsBlockSize; i < last; ++i) {
+        const double dx = bodies[i].x - center_x;
+        const double dy = bodies[i].y - center_y;
+        sum_distance += std::sqrt(dx * dx + dy * dy);
+      }
+      bounds_blocks_[block].sum_distance = sum_distance;
+    }
+  });
+  for (int block = 0; block < block_count; ++block) {
+    total.sum_distance += bounds_blocks_[block].sum_distance;
+  }
+
+  // 3. Обрезаем крайние координаты кругом вокруг среднего положения тел.
+  // Статистика считается по числу тел, а не по массе, иначе тяжёлое
+  // центральное тело сжало бы круг до своих размеров. Среднее расстояние, в
+  // отличие от среднеквадратичного, почти не растёт от одного далёкого тела.
+  float min_x = total.min_x;
+  float max_x = total.max_x;
+  float min_y = total.min_y;
+  float max_y = total.max_y;
+  double cutoff = kOverflowRadiusFactor * total.sum_distance / count;
+  if (cutoff > 0.0) {
+    min_x = std::max(min_x, static_cast<float>(center_x - cutoff));
+    max_x = std::min(max_x, static_cast<float>(center_x + cutoff));
+    min_y = std::max(min_y, static_cast<float>(center_y - cutoff));
+    max_y = std::min(max_y, static_cast<float>(center_y + cutoff));
+  }
+
+  // 4. Квадратный корень с небольшим запасом, чтобы крайние тела не выпадали
+  // из-за округления
+  float half_dim = std::max(max_x - min_x, max_y - min_y) * 0.5f;
+  half_dim = half_dim > 0.0f ? half_dim * 1.001f : 1.0f;
+  boundary_ = {(min_x + max_x) * 0.5f, (min_y + max_y) * 0.5f, half_dim};
+}
+
+void Quadtree::build(std::vector<CelestialBody>& bodies, ThreadPool& pool) {
+  nodes_.clear();
+  bodies_.clear();
+  leaf_nodes_.clear();
+  depth_ = 0;
+  subtree_count_ = 0;
+  add_node(boundary_);
+
+  const int count = static_cast<int>(bodies.size());
+  keys_.resize(count);
+  order_.resize(count);
+  sorted_keys_.resize(count);
+  sorted_order_.resize(count);
+
+  // 1. Вычисляем ключи Мортона по блокам; тела вне корня откладываем в конец,
+  // сохраняя их исходный порядок. Пока ключ и признак тела внутри корня
+  // лежат в буферах сортировки по исходному номеру тела.
+  const float min_x = boundary_.x - boundary_.half_dim;
+  const float min_y = boundary_.y - boundary_.half_dim;
+  const float max_x = boundary_.x + boundary_.half_dim;
+  const float max_y = boundary_.y + boundary_.half_dim;
+  const float scale = kMortonCells / (boundary_.half_dim * 2.0f);
+  const int block_count = (count + kSortBlockSize - 1) / kSortBlockSize;
+  block_starts_.assign(2 * block_count, 0);
+  pool.parallel_for(block_count, 1, [&](int begin, int end) {
+    for (int block = begin; block < end; ++block) {
+      const int last = std::min(count, (block + 1) * kSortBlockSize);
+      int block_inside = 0;
+      for (int i = block * kSortBlockSize; i < last; ++i) {
+        const CelestialBody& body = bodies[i];
+        const bool is_inside = body.x >= min_x && body.x <= max_x &&
+                               body.y >= min_y && body.y <= max_y;
+        sorted_order_[i] = is_inside;
+        if (is_inside) {
+          sorted_keys_[i] = morton_key(quantize(body.x, min_x, scale),
+                                       quantize(body.y, min_y, scale));
+          ++block_inside;
+        }
+      }
+      block_starts_[2 * block] = block_inside;
+      block_starts_[2 * block + 1] =
+          last - block * kSortBlockSize - block_inside;
+    }
+  });
+  int inside = 0;
+  for (int block = 0; block < block_count; ++block) {
+    inside += block_starts_[2 * block];
+  }
+  int inside_start = 0;
+  int outside_start = inside;
+  for (int block = 0; block < block_count; ++block) {
+    const int block_inside = block_starts_[2 * block];
+    const int block_outside = block_starts_[2 * block + 1];
+    block_starts_[2 * block] = inside_start;
+    block_starts_[2 * block + 1] = outside_start;
+    inside_start += block_inside;
+    outside_start += block_outside;
+  }
+  pool.parallel_for(block_count, 1, [&](int begin, int end) {
+    for (int block = begin; block < end; ++block) {
+      const int last = std::min(count, (block + 1) * kSortBlockSize);
+      int inside_position = block_starts_[2 * block];
+      int outside_position = block_starts_[2 * block + 1];
+      for (int i = block * kSortBlockSize; i < last; ++i) {
+        if (sorted_order_[i]) {
+          keys_[inside_position] = sorted_keys_[i];
+          order_[inside_position++] = i;
+        } else {
+          order_[outside_position++] = i;
+        }
+      }
+    }
+  });
 
-void Quadtree::subdivide() {
-  float x = boundary_.x;
-  float y = boundary_.y;
-  float hd = boundary_.half_dim / 2.0f;
+  // 2. Сортируем тела по ключу, чтобы близкие в пространстве тела оказались
+  // рядом и в памяти
+  sort_by_morton_key(inside, pool);
+  body_scratch_.resize(count);
+  pool.parallel_for(count, kSortBlockSize, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      body_scratch_[i] = bodies[order_[i]];
+    }
+  });
+  bodies.swap(body_scratch_);
+
+  // 3. Строим верхнюю часть дерева, а поддеревья отложенных узлов — в
+  // параллельных задачах, каждое в своём массиве узлов
+  assign_body_pointers(bodies, inside);
+  const int max_subtree_bodies =
+      std::max(kMinSubtreeBodies, inside / kSubtreeTarget);
+  build_node(nodes_, leaf_nodes_, depth_, 0, 0, inside, 0,
+             max_subtree_bodies);
+  top_node_count_ = static_cast<int>(nodes_.size());
+  pool.parallel_for(subtree_count_, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      SubtreeBuild& subtree = subtree_builds_[i];
+      subtree.nodes.assign(1, nodes_[subtree.root]);
+      subtree.leaves.clear();
+      subtree.depth = subtree.level;
+      build_node(subtree.nodes, subtree.leaves, subtree.depth, 0,
+                 subtree.begin, subtree.end, subtree.level, -1);
+    }
+  });
+
+  // 4. Переносим поддеревья в nodes_ за верхней частью. Узел 0 поддерева —
+  // копия его корня, остальные сдвигаются на offset - 1.
+  int node_count = top_node_count_;
+  for (int i = 0; i < subtree_count_; ++i) {
+    SubtreeBuild& subtree = subtree_builds_[i];
+    subtree.offset = node_count;
+    node_count += static_cast<int>(subtree.nodes.size()) - 1;
+    depth_ = std::max(depth_, subtree.depth);
+  }
+  nodes_.resize(node_count);
+  pool.parallel_for(subtree_count_, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const SubtreeBuild& subtree = subtree_builds_[i];
+      const int shift = subtree.offset - 1;
+      nodes_[subtree.root].first_child = subtree.nodes[0].first_child + shift;
+      for (size_t k = 1; k < subtree.nodes.size(); ++k) {
+        QuadtreeNode node = subtree.nodes[k];
+        if (node.first_child >= 0) {
+          node.first_child += shift;
+        }
+        nodes_[shift + k] = node;
+      }
+    }
+  });
+  // Листья поддеревьев встают на место отметок, порядок обхода сохраняется
+  if (subtree_count_ > 0) {
+    leaf_scratch_.clear();
+    for (int leaf : leaf_nodes_) {
+      if (leaf >= 0) {
+        leaf_scratch_.push_back(leaf);
+        continue;
+      }
+      const SubtreeBuild& subtree = subtree_builds_[-1 - leaf];
+      for (int local_leaf : subtree.leaves) {
+        leaf_scratch_.push_back(local_leaf + subtree.offset - 1);
+      }
+    }
+    leaf_nodes_.swap(leaf_scratch_);
+  }
+  leaf_bodies_only_ = true;
+
+  node_leaf_.assign(nodes_.size(), -1);
+  for (size_t leaf = 0; leaf < leaf_nodes_.size(); ++leaf) {
+    node_leaf_[leaf_nodes_[leaf]] = static_cast<int>(leaf);
+  }
+}
+
+bool Quadtree::refit(std::vector<CelestialBody>& bodies) {
+  // 1. Дерево должно описывать этот же массив тел
+  if (!matches_bodies(bodies)) {
+    return false;
+  }
+  const int count = static_cast<int>(bodies.size());
+  const int inside = static_cast<int>(bodies_.size());
+
+  // 2. Лист каждого тела: прежний, если тело осталось в его границах, иначе
+  // найденный спуском от корня. Номер leaf_count означает тело вне корня.
+  const int leaf_count = static_cast<int>(leaf_nodes_.size());
+  body_leaves_.resize(count);
+  leaf_starts_.assign(leaf_count + 2, 0);
+  int moved = 0;
+  for (int leaf = 0; leaf < leaf_count; ++leaf) {
+    const QuadtreeNode& node = nodes_[leaf_nodes_[leaf]];
+    for (int i = node.first_body; i < node.first_body + node.body_count; ++i) {
+      int target = leaf;
+      if (!contains(node.boundary, bodies[i])) {
+        target = find_leaf(bodies[i]);
+        ++moved;
+      }
+      body_leaves_[i] = target;
+      ++leaf_starts_[target + 1];
+    }
+  }
+  for (int i = inside; i < count; ++i) {
+    int target = find_leaf(bodies[i]);
+    if (target != leaf_count) {
+      ++moved;
+    }
+    body_leaves_[i] = target;
+    ++leaf_starts_[target + 1];
+  }
+  if (moved > kRefitMaxMovedFraction * count) {
+    return false;
+  }
+  const int max_leaf_count = kRefitMaxLeafFactor * capacity_;
+  for (int leaf = 0; leaf < leaf_count; ++leaf) {
+    if (leaf_starts_[leaf + 1] > max_leaf_count) {
+      return false;
+    }
+  }
+
+  // 3. Начала диапазонов листьев. Листья лежат в порядке обхода дерева,
+  // поэтому диапазоны поддеревьев остаются непрерывными.
+  for (int leaf = 0; leaf <= leaf_count; ++leaf) {
+    leaf_starts_[leaf + 1] += leaf_starts_[leaf];
+  }
+  for (int leaf = 0; leaf < leaf_count; ++leaf) {
+    QuadtreeNode& node = nodes_[leaf_nodes_[leaf]];
+    node.first_body = leaf_starts_[leaf];
+    node.body_count = leaf_starts_[leaf + 1] - leaf_starts_[leaf];
+  }
+  const int new_inside = leaf_starts_[leaf_count];
+
+  // 4. Переставляем тела, только если какое-то сменило лист. Сортировка
+  // устойчива, поэтому тела вне корня сохраняют порядок.
+  if (moved > 0) {
+    body_scratch_.resize(count);
+    for (int i = 0; i < count; ++i) {
+      body_scratch_[leaf_starts_[body_leaves_[i]]++] = bodies[i];
+    }
+    bodies.swap(body_scratch_);
+  }
+  assign_body_pointers(bodies, new_inside);
+  return true;
+}
 
-  Boundary nw = {x - hd, y - hd, hd};
-  northwest_ = std::make_unique<Quadtree>(nw, capacity_);
+void Quadtree::erase_collided(std::vector<CelestialBody>& bodies) {
+  auto is_collided = [](const CelestialBody& body) { return body.collided; };
+  if (!matches_bodies(bodies)) {
+    bodies.erase(std::remove_if(bodies.begin(), bodies.end(), is_collided),
+                 bodies.end());
+    return;
+  }
 
-  Boundary ne = {x + hd, y - hd, hd};
-  northeast_ = std::make_unique<Quadtree>(ne, capacity_);
+  // Диапазоны листьев идут подряд от начала массива, поэтому при сдвиге тел
+  // к началу каждый лист сдвигается на число удалённых до него тел
+  const int count = static_cast<int>(bodies.size());
+  int removed = 0;
+  for (int node_index : leaf_nodes_) {
+    QuadtreeNode& node = nodes_[node_index];
+    const int end = node.first_body + node.body_count;
+    node.first_body -= removed;
+    for (int i = node.first_body + removed; i < end; ++i) {
+      if (bodies[i].collided) {
+        ++removed;
+        --node.body_count;
+      } else if (removed > 0) {
+        bodies[i - removed] = bodies[i];
+      }
+    }
+  }
+  const int inside = static_cast<int>(bodies_.size()) - removed;
+  for (int i = static_cast<int>(bodies_.size()); i < count; ++i) {
+    if (bodies[i].collided) {
+      ++removed;
+    } else if (removed > 0) {
+      bodies[i - removed] = bodies[i];
+    }
+  }
+  bodies.resize(count - removed);
+  assign_body_pointers(bodies, inside);
+}
+
+bool Quadtree::matches_bodies(const std::vector<CelestialBody>& bodies) const {
+  // Дерево из build() ссылается на тела массива подряд: сначала тела листьев,
+  // затем тела вне корня
+  const int inside = static_cast<int>(bodies_.size());
+  return leaf_bodies_only_ && !bodies.empty() &&
+         bodies.size() == bodies_.size() + overflow_bodies_.size() &&
+         (inside > 0 ? bodies_[0] : overflow_bodies_[0]) == bodies.data();
+}
 
-  Boundary sw = {x - hd, y + hd, hd};
-  southwest_ = std::make_unique<Quadtree>(sw, capacity_);
+void Quadtree::assign_body_pointers(std::vector<CelestialBody>& bodies,
+                                    int inside) {
+  const int count = static_cast<int>(bodies.size());
+  bodies_.resize(inside);
+  for (int i = 0; i < inside; ++i) {
+    bodies_[i] = &bodies[i];
+  }
+  overflow_bodies_.resize(count - inside);
+  for (int i = inside; i < count; ++i) {
+    overflow_bodies_[i - inside] = &bodies[i];
+  }
+}
 
-  Boundary se = {x + hd, y + hd, hd};
-  southeast_ = std::make_unique<Quadtree>(se, capacity_);
+int Quadtree::find_leaf(const CelestialBody& body) const {
+  if (!contains(nodes_[0].boundary, body)) {
+    return static_cast<int>(leaf_nodes_.size());
+  }
+  int node_index = 0;
+  while (nodes_[node_index].first_child >= 0) {
+    const QuadtreeNode& node = nodes_[node_index];
+    int quadrant = ((body.y >= node.boundary.y) << 1) |
+                   static_cast<int>(body.x >= node.boundary.x);
+    node_index = node.first_child + quadrant;
+  }
+  return node_leaf_[node_index];
+}
 
-  divided_ = true;
+void Quadtree::sort_by_morton_key(int count, ThreadPool& pool) {
+  // Поразрядная сортировка (LSD) по байтам ключа. Каждый блок тел считает
+  // свои разряды, смещения складываются по разряду и затем по блокам, так
+  // что сортировка устойчива, а блоки раскладывают тела независимо.
+  // Тела вне корня лежат за count в обоих буферах порядка и не двигаются.
+  std::copy(order_.begin() + count, order_.end(),
+            sorted_order_.begin() + count);
+  const int block_count = (count + kSortBlockSize - 1) / kSortBlockSize;
+  digit_offsets_.resize(block_count * 256);
+  for (int shift = 0; shift < 32; shift += 8) {
+    pool.parallel_for(block_count, 1, [&](int begin, int end) {
+      for (int block = begin; block < end; ++block) {
+        int* offsets = &digit_offsets_[block * 256];
+        std::fill(offsets, offsets + 256, 0);
+        const int last = std::min(count, (block + 1) * kSortBlockSize);
+        for (int i = block * kSortBlockSize; i < last; ++i) {
+          offsets[(keys_[i] >> shift) & 0xFF]++;
+        }
+      }
+    });
+    if (count == 0) {
+      return;
+    }
+    const int first_digit = (keys_[0] >> shift) & 0xFF;
+    int first_digit_count = 0;
+    for (int block = 0; block < block_count; ++block) {
+      first_digit_count += digit_offsets_[block * 256 + first_digit];
+    }
+    if (first_digit_count == count) {
+      continue;  // Все ключи совпадают в этом разряде
+    }
+    int sum = 0;
+    for (int digit = 0; digit < 256; ++digit) {
+      for (int block = 0; block < block_count; ++block) {
+        int& offset = digit_offsets_[block * 256 + digit];
+        int digit_count = offset;
+        offset = sum;
+        sum += digit_count;
+      }
+    }
+    pool.parallel_for(block_count, 1, [&](int begin, int end) {
+      for (int block = begin; block < end; ++block) {
+        int* offsets = &digit_offsets_[block * 256];
+        const int last = std::min(count, (block + 1) * kSortBlockSize);
+        for (int i = block * kSortBlockSize; i < last; ++i) {
+          int position = offsets[(keys_[i] >> shift) & 0xFF]++;
+          sorted_keys_[position] = keys_[i];
+          sorted_order_[position] = order_[i];
+        }
+      }
+    });
+    keys_.swap(sorted_keys_);
+    order_.swap(sorted_order_);
+  }
+}
+
+void Quadtree::build_node(std::vector<QuadtreeNode>& nodes,
+                          std::vector<int>& leaves, int& depth, int node_index,
+                          int begin, int end, int level,
+                          int max_subtree_bodies) {
+  depth = std::max(depth, level);
+  if (end - begin <= capacity_ || level == kMortonBits) {
+    QuadtreeNode& node = nodes[node_index];
+    node.first_body = begin;
+    node.body_count = end - begin;
+    leaves.push_back(node_index);
+    return;
+  }
+  if (end - begin <= max_subtree_bodies) {
+    // Отметка -1 - i в списке листьев заменится листьями поддерева
+    if (subtree_count_ == static_cast<int>(subtree_builds_.size())) {
+      subtree_builds_.emplace_back();
+    }
+    SubtreeBuild& subtree = subtree_builds_[subtree_count_];
+    subtree.root = node_index;
+    subtree.begin = begin;
+    subtree.end = end;
+    subtree.level = level;
+    leaves.push_back(-1 - subtree_count_);
+    ++subtree_count_;
+    return;
+  }
+
+  subdivide(nodes, node_index);
+  int first_child = nodes[node_index].first_child;
+  // Тела узла отсортированы, поэтому каждому потомку соответствует
+  // непрерывный поддиапазон с одинаковой парой разрядов ключа
+  int shift = 2 * (kMortonBits - 1 - level);
+  int child_begin = begin;
+  for (int quadrant = 0; quadrant < 4; ++quadrant) {
+    int child_end = end;
+    if (quadrant < 3) {
+      child_end = static_cast<int>(
+          std::partition_point(keys_.begin() + child_begin,
+                               keys_.begin() + end,
+                               [shift, quadrant](uint32_t key) {
+                                 return static_cast<int>((key >> shift) & 3) <=
+                                        quadrant;
+                               }) -
+          keys_.begin());
+    }
+    build_node(nodes, leaves, depth, first_child + quadrant, child_begin,
+               child_end, level + 1, max_subtree_bodies);
+    child_begin = child_end;
+  }
 }
 
 void Quadtree::insert(CelestialBody* body) {
-  if (body->x < boundary_.x - boundary_.half_dim ||
-      body->x > boundary_.x + boundary_.half_dim ||
-      body->y < boundary_.y - boundary_.half_dim ||
-      body->y > boundary_.y + boundary_.half_dim) {
-    return;  // Тело за пределами этого квадранта
+  leaf_bodies_only_ = false;
+  if (!insert(0, body)) {
+    overflow_bodies_.push_back(body);
   }
+}
 
-  if (bodies_.size() < capacity_) {
-    bodies_.push_back(body);
-  } else {
-    if (!divided_) {
-      subdivide();
+bool Quadtree::insert(int node_index, CelestialBody* body) {
+  const Boundary& boundary = nodes_[node_index].boundary;
+  if (body->x < boundary.x - boundary.half_dim ||
+      body->x > boundary.x + boundary.half_dim ||
+      body->y < boundary.y - boundary.half_dim ||
+      body->y > boundary.y + boundary.half_dim) {
+    return false;  // Тело за пределами этого квадранта
+  }
+
+  QuadtreeNode& node = nodes_[node_index];
+  if (node.body_count < capacity_) {
+    if (node.body_count == 0) {
+      // Слоты под тела выделяются при первой вставке в узел
+      node.first_body = static_cast<int>(bodies_.size());
+      bodies_.resize(bodies_.size() + capacity_);
+    }
+    bodies_[node.first_body + node.body_count++] = body;
+    return true;
+  }
+
+  if (node.first_child < 0) {
+    subdivide(nodes_, node_index);
+  }
+  // subdivide() мог перераспределить массив узлов, ссылка больше не валидна
+  int first_child = nodes_[node_index].first_child;
+  for (int i = 0; i < 4; ++i) {
+    // Тело на границе квадрантов попадает только в первый подходящий
+    if (insert(first_child + i, body)) {
+      return true;
     }
-    northwest_->insert(body);
-    northeast_->insert(body);
-    southwest_->insert(body);
-    southeast_->insert(body);
   }
+  return false;
 }
 
 void Quadtree::query(const Boundary& range,
                      std::vector<CelestialBody*>& found) {
+  query(0, range, found);
+}
+
+void Quadtree::query(int node_index, const Boundary& range,
+                     std::vector<CelestialBody*>& found) {
+  const QuadtreeNode& node = nodes_[node_index];
+  const Boundary& boundary = node.boundary;
   // Проверка на пересечение диапазонов
-  if (range.x - range.half_dim > boundary_.x + boundary_.half_dim ||
-      range.x + range.half_dim < boundary_.x - boundary_.half_dim ||
-      range.y - range.half_dim > boundary_.y + boundary_.half_dim ||
-      range.y + range.half_dim < boundary_.y - boundary_.half_dim) {
+  if (range.x - range.half_dim > boundary.x + boundary.half_dim ||
+      range.x + range.half_dim < boundary.x - boundary.half_dim ||
+      range.y - range.half_dim > boundary.y + boundary.half_dim ||
+      range.y + range.half_dim < boundary.y - boundary.half_dim) {
     return;
   }
 
-  for (auto& body : bodies_) {
+  for (int i = 0; i < node.body_count; ++i) {
+    CelestialBody* body = bodies_[node.first_body + i];
     if (body->x >= range.x - range.half_dim &&
         body->x <= range.x + range.half_dim &&
         body->y >= range.y - range.half_dim &&
@@ -65,108 +701,476 @@ void Quadtree::query(const Boundary& range,
     }
   }
 
-  if (divided_) {
-    northwest_->query(range, found);
-    northeast_->query(range, found);
-    southwest_->query(range, found);
-    southeast_->query(range, found);
+  if (node.first_child >= 0) {
+    for (int i = 0; i < 4; ++i) {
+      query(node.first_child + i, range, found);
+    }
   }
 }
 
 void Quadtree::clear() {
+  // Память массивов сохраняется для следующего построения
+  nodes_.clear();
   bodies_.clear();
-  divided_ = false;
-  northwest_.reset();
-  northeast_.reset();
-  southwest_.reset();
-  southeast_.reset();
-  total_mass_ = 0.0f;
-  center_of_mass_x_ = 0.0f;
-  center_of_mass_y_ = 0.0f;
-}
-
-void Quadtree::compute_mass_distribution() {
-  if (bodies_.empty()) {
+  overflow_bodies_.clear();
+  depth_ = 0;
+  subtree_count_ = 0;
+  add_node(boundary_);
+}
+
+void Quadtree::compute_mass_distribution(ThreadPool& pool) {
+  body_x_.resize(bodies_.size());
+  body_y_.resize(bodies_.size());
+  body_mass_.resize(bodies_.size());
+  // Поддеревья из build() не пересекаются ни по узлам, ни по телам и
+  // считаются параллельно, затем верхняя часть собирает их моменты. Порядок
+  // сложения в каждом узле тот же, что и при обходе одним потоком.
+  pool.parallel_for(subtree_count_, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      compute_mass_distribution(subtree_builds_[i].root, false);
+    }
+  });
+  compute_mass_distribution(0, subtree_count_ > 0);
+
+  overflow_x_.resize(overflow_bodies_.size());
+  overflow_y_.resize(overflow_bodies_.size());
+  overflow_mass_.resize(overflow_bodies_.size());
+  for (size_t i = 0; i < overflow_bodies_.size(); ++i) {
+    overflow_x_[i] = overflow_bodies_[i]->x;
+    overflow_y_[i] = overflow_bodies_[i]->y;
+    overflow_mass_[i] = overflow_bodies_[i]->mass;
+  }
+}
+
+void Quadtree::compute_mass_distribution(int node_index, bool top_only) {
+  // Потомки корня поддерева лежат за верхней частью дерева
+  if (top_only && nodes_[node_index].first_child >= top_node_count_) {
     return;
   }
+  Real total_mass = 0.0f;
+  Real weighted_x = 0.0f;
+  Real weighted_y = 0.0f;
+  int body_count = 0;
 
-  if (bodies_.size() == 1) {
-    total_mass_ = bodies_[0]->mass;
-    center_of_mass_x_ = bodies_[0]->x;
-    center_of_mass_y_ = bodies_[0]->y;
-  } else {
-    for (const auto& body : bodies_) {
-      total_mass_ += body->mass;
-      center_of_mass_x_ += body->x * body->mass;
-      center_of_mass_y_ += body->y * body->mass;
+  const QuadtreeNode& node = nodes_[node_index];
+  body_count += node.body_count;
+  for (int i = node.first_body; i < node.first_body + node.body_count; ++i) {
+    const CelestialBody* body = bodies_[i];
+    body_x_[i] = body->x;
+    body_y_[i] = body->y;
+    body_mass_[i] = body->mass;
+    total_mass += body->mass;
+    weighted_x += body->x * body->mass;
+    weighted_y += body->y * body->mass;
+  }
+
+  // Масса узла включает массу всего поддерева
+  if (node.first_child >= 0) {
+    for (int i = 0; i < 4; ++i) {
+      int child_index = node.first_child + i;
+      compute_mass_distribution(child_index, top_only);
+      const QuadtreeNode& child = nodes_[child_index];
+      body_count += child.subtree_body_count;
+      total_mass += child.total_mass;
+      weighted_x += child.center_of_mass_x * child.total_mass;
+      weighted_y += child.center_of_mass_y * child.total_mass;
     }
-    center_of_mass_x_ /= total_mass_;
-    center_of_mass_y_ /= total_mass_;
   }
 
-  if (divided_) {
-    northwest_->compute_mass_distribution();
-    northeast_->compute_mass_distribution();
-    southwest_->compute_mass_distribution();
-    southeast_->compute_mass_distribution();
+  QuadtreeNode& result = nodes_[node_index];
+  result.subtree_body_count = body_count;
+  result.total_mass = total_mass;
+  if (total_mass > 0.0f) {
+    result.center_of_mass_x = weighted_x / total_mass;
+    result.center_of_mass_y = weighted_y / total_mass;
+  } else {
+    result.center_of_mass_x = result.boundary.x;
+    result.center_of_mass_y = result.boundary.y;
+  }
+
+  // Моменты потомков переносятся в центр масс узла по теореме Штейнера
+  const Real center_x = result.center_of_mass_x;
+  const Real center_y = result.center_of_mass_y;
+  Real quadrupole_xx = 0.0f;
+  Real quadrupole_xy = 0.0f;
+  Real quadrupole_yy = 0.0f;
+  for (int i = result.first_body; i < result.first_body + result.body_count;
+       ++i) {
+    const CelestialBody* body = bodies_[i];
+    Real dx = body->x - center_x;
+    Real dy = body->y - center_y;
+    quadrupole_xx += body->mass * dx * dx;
+    quadrupole_xy += body->mass * dx * dy;
+    quadrupole_yy += body->mass * dy * dy;
+  }
+  if (result.first_child >= 0) {
+    for (int i = 0; i < 4; ++i) {
+      const QuadtreeNode& child = nodes_[result.first_child + i];
+      Real dx = child.center_of_mass_x - center_x;
+      Real dy = child.center_of_mass_y - center_y;
+      quadrupole_xx += child.quadrupole_xx + child.total_mass * dx * dx;
+      quadrupole_xy += child.quadrupole_xy + child.total_mass * dx * dy;
+      quadrupole_yy += child.quadrupole_yy + child.total_mass * dy * dy;
+    }
   }
+  result.quadrupole_xx = quadrupole_xx;
+  result.quadrupole_xy = quadrupole_xy;
+  result.quadrupole_yy = quadrupole_yy;
 }
 
 void Quadtree::calculate_force(CelestialBody& body, float theta, float G,
                                float softening_factor) {
-  if (bodies_.empty() || (bodies_.size() == 1 && bodies_[0]->id == body.id)) {
+  // Далёкие узлы копируются в пакет для квадрупольного ядра, а тела ближних
+  // узлов читаются прямо из массивов SoA
+  constexpr int kBatchSize = 64;
+  alignas(64) KernelReal batch_x[kBatchSize];
+  alignas(64) KernelReal batch_y[kBatchSize];
+  alignas(64) KernelReal batch_mass[kBatchSize];
+  alignas(64) KernelReal batch_xx[kBatchSize];
+  alignas(64) KernelReal batch_xy[kBatchSize];
+  alignas(64) KernelReal batch_yy[kBatchSize];
+  int batch_count = 0;
+
+  // На каждом уровне в стеке остаётся не больше трёх соседей, поэтому такого
+  // запаса хватает на глубину, которую допускает точность float
+  constexpr int kStackSize = 256;
+  int stack[kStackSize];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  const KernelReal softening_sq = softening_factor * softening_factor;
+  const float theta_sq = theta * theta;
+  const KernelReal x = body.x;
+  const KernelReal y = body.y;
+  KernelReal ax = 0.0f;
+  KernelReal ay = 0.0f;
+
+  while (stack_size > 0) {
+    const QuadtreeNode& node = nodes_[stack[--stack_size]];
+    if (node.total_mass == 0.0f) {
+      continue;
+    }
+
+    Real dx = node.center_of_mass_x - body.x;
+    Real dy = node.center_of_mass_y - body.y;
+    float size = node.boundary.half_dim * 2.0f;
+    if (size * size < theta_sq * (dx * dx + dy * dy)) {
+      // Узел достаточно далеко, аппроксимируем
+      batch_x[batch_count] = node.center_of_mass_x;
+      batch_y[batch_count] = node.center_of_mass_y;
+      batch_mass[batch_count] = node.total_mass;
+      batch_xx[batch_count] = node.quadrupole_xx;
+      batch_xy[batch_count] = node.quadrupole_xy;
+      batch_yy[batch_count] = node.quadrupole_yy;
+      if (++batch_count == kBatchSize) {
+        accumulate_quadrupole_acceleration(
+            x, y, batch_x, batch_y, batch_mass, batch_xx, batch_xy, batch_yy,
+            batch_count, softening_sq, ax, ay);
+        batch_count = 0;
+      }
+      continue;
+    }
+
+    // Узел слишком близко: тела самого узла считаем напрямую, а потомков
+    // обходим. Вклад самого тела равен нулю, поэтому его не исключаем.
+    if (node.body_count > 0) {
+      accumulate_acceleration(x, y, body_x_.data() + node.first_body,
+                              body_y_.data() + node.first_body,
+                              body_mass_.data() + node.first_body,
+                              node.body_count, softening_sq, ax, ay);
+    }
+    if (node.first_child >= 0) {
+      for (int i = 3; i >= 0; --i) {
+        stack[stack_size++] = node.first_child + i;
+      }
+    }
+  }
+
+  accumulate_quadrupole_acceleration(x, y, batch_x, batch_y, batch_mass,
+                                     batch_xx, batch_xy, batch_yy, batch_count,
+                                     softening_sq, ax, ay);
+  body.ax += G * ax;
+  body.ay += G * ay;
+}
+
+void Quadtree::calculate_forces(ThreadPool& pool, float theta, float G,
+                                float softening_factor, int active_level) {
+  force_groups_.clear();
+  collect_force_groups(0);
+  // Каждый блок групп считает свою работу в отдельной ячейке, без атомиков
+  const int group_count = static_cast<int>(force_groups_.size());
+  chunk_stats_.assign((group_count + kForceGroupChunk - 1) / kForceGroupChunk,
+                      ForceWalkStats());
+  pool.parallel_for(group_count, kForceGroupChunk, [&](int begin, int end) {
+    ForceWalkStats& stats = chunk_stats_[begin / kForceGroupChunk];
+    for (int i = begin; i < end; ++i) {
+      calculate_group_force(force_groups_[i], theta, G, softening_factor,
+                            active_level, stats);
+    }
+  });
+  force_stats_ = ForceWalkStats();
+  for (const ForceWalkStats& stats : chunk_stats_) {
+    force_stats_.force_bodies += stats.force_bodies;
+    force_stats_.node_visits += stats.node_visits;
+    force_stats_.interactions += stats.interactions;
+  }
+}
+
+void Quadtree::calculate_overflow_forces(ThreadPool& pool, float theta,
+                                         float G, float softening_factor,
+                                         int active_level) {
+  const int overflow_count = static_cast<int>(overflow_bodies_.size());
+  if (overflow_count == 0) {
     return;
   }
+  const KernelReal softening_sq = softening_factor * softening_factor;
 
-  float dx = center_of_mass_x_ - body.x;
-  float dy = center_of_mass_y_ - body.y;
-  float dist_sq = dx * dx + dy * dy;
-  float dist = std::sqrt(dist_sq);
+  // Тел вне корня обычно единицы, поэтому тела дерева суммируют их напрямую
+  pool.parallel_for(get_body_count(), kOverflowChunk, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      if (bodies_[i] == nullptr) continue;  // пустой слот после insert()
+      if (bodies_[i]->timestep_level < active_level) continue;
+      KernelReal ax = 0.0f;
+      KernelReal ay = 0.0f;
+      accumulate_acceleration(body_x_[i], body_y_[i], overflow_x_.data(),
+                              overflow_y_.data(), overflow_mass_.data(),
+                              overflow_count, softening_sq, ax, ay);
+      bodies_[i]->ax += G * ax;
+      bodies_[i]->ay += G * ay;
+    }
+  });
 
-  if ((boundary_.half_dim * 2.0f) / dist < theta && bodies_.size() > 1) {
-    // Узел достаточно далеко, аппроксимируем
-    float force_magnitude = (G * body.mass * total_mass_) /
-                            (dist_sq + softening_factor * softening_factor);
-    float dir_x = dx / dist;
-    float dir_y = dy / dist;
-    body.ax += dir_x * force_magnitude / body.mass;
-    body.ay += dir_y * force_magnitude / body.mass;
-  } else {
-    // Узел слишком близко, рекурсивно спускаемся
-    if (divided_) {
-      northwest_->calculate_force(body, theta, G, softening_factor);
-      northeast_->calculate_force(body, theta, G, softening_factor);
-      southwest_->calculate_force(body, theta, G, softening_factor);
-      southeast_->calculate_force(body, theta, G, softening_factor);
-    }
-    // И вычисляем силы от тел в этом узле
-    for (auto& other_body : bodies_) {
-      if (other_body->id == body.id) continue;
-      float dx_b = other_body->x - body.x;
-      float dy_b = other_body->y - body.y;
-      float dist_sq_b =
-          dx_b * dx_b + dy_b * dy_b + softening_factor * softening_factor;
-      float dist_b = std::sqrt(dist_sq_b);
-      float force_magnitude_b = (G * body.mass * other_body->mass) / dist_sq_b;
-      float dir_x_b = dx_b / dist_b;
-      float dir_y_b = dy_b / dist_b;
-      body.ax += dir_x_b * force_magnitude_b / body.mass;
-      body.ay += dir_y_b * force_magnitude_b / body.mass;
-    }
-  }
-}
-
-const std::vector<std::unique_ptr<Quadtree>>& Quadtree::get_children() const {
-  // This is a bit of a hack to return a consistent type, even though the
-  // children are stored as individual members. For a real application, you
-  // might want to refactor how children are stored if you need to iterate over
-  // them frequently.
-  static std::vector<std::unique_ptr<Quadtree>> children_vector;
-  children_vector.clear();
-  if (divided_) {
-    // This is not ideal as it would involve some sort of transfer of ownership
-    // or raw pointers for simplicity we will just leave this empty as it is for
-    // debugging
-  }
-  return children_vector;
+  for (CelestialBody* body : overflow_bodies_) {
+    if (body->timestep_level < active_level) continue;
+    calculate_force(*body, theta, G, softening_factor);
+    KernelReal ax = 0.0f;
+    KernelReal ay = 0.0f;
+    accumulate_acceleration(
+        static_cast<KernelReal>(body->x), static_cast<KernelReal>(body->y),
+        overflow_x_.data(), overflow_y_.data(), overflow_mass_.data(),
+        overflow_count, softening_sq, ax, ay);
+    body->ax += G * ax;
+    body->ay += G * ay;
+  }
+}
+
+void Quadtree::collect_force_groups(int node_index) {
+  const QuadtreeNode& node = nodes_[node_index];
+  if (node.subtree_body_count == 0) {
+    return;
+  }
+  if (node.first_child < 0 || node.subtree_body_count <= kForceGroupSize) {
+    force_groups_.push_back({node_index, true});
+    return;
+  }
+  // Тела, хранящиеся во внутреннем узле (при заполнении через insert()),
+  // образуют отдельную группу
+  if (node.body_count > 0) {
+    force_groups_.push_back({node_index, false});
+  }
+  for (int i = 0; i < 4; ++i) {
+    collect_force_groups(node.first_child + i);
+  }
+}
+
+void Quadtree::calculate_group_force(const ForceGroup& group, float theta,
+                                     float G, float softening_factor,
+                                     int active_level, ForceWalkStats& stats) {
+  thread_local InteractionList list;
+  list.clear();
+
+  // 1. Собираем тела группы, которым нужны силы, и их ограничивающий
+  // прямоугольник. Группа без таких тел дерево не обходит.
+  int stack[256];
+  int stack_size = 0;
+  stack[stack_size++] = group.node_index;
+  while (stack_size > 0) {
+    const QuadtreeNode& node = nodes_[stack[--stack_size]];
+    for (int i = node.first_body; i < node.first_body + node.body_count; ++i) {
+      if (active_level > 0 && bodies_[i]->timestep_level < active_level) {
+        continue;
+      }
+      list.targets.push_back(i);
+    }
+    if (group.whole_subtree && node.first_child >= 0) {
+      for (int i = 0; i < 4; ++i) {
+        stack[stack_size++] = node.first_child + i;
+      }
+    }
+  }
+  if (list.targets.empty()) {
+    return;
+  }
+  Real min_x = body_x_[list.targets[0]];
+  Real max_x = min_x;
+  Real min_y = body_y_[list.targets[0]];
+  Real max_y = min_y;
+  for (int target : list.targets) {
+    min_x = std::min<Real>(min_x, body_x_[target]);
+    max_x = std::max<Real>(max_x, body_x_[target]);
+    min_y = std::min<Real>(min_y, body_y_[target]);
+    max_y = std::max<Real>(max_y, body_y_[target]);
+  }
+
+  // 2. Обходим дерево один раз для всей группы. Узел аппроксимируется, если
+  // критерий выполняется для ближайшей к нему точки прямоугольника группы, а
+  // значит, и для каждого тела группы.
+  const float theta_sq = theta * theta;
+  stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    const QuadtreeNode& node = nodes_[stack[--stack_size]];
+    ++stats.node_visits;
+    if (node.total_mass == 0.0f) {
+      continue;
+    }
+
+    Real dx = std::max<Real>(
+        {min_x - node.center_of_mass_x, node.center_of_mass_x - max_x, 0.0f});
+    Real dy = std::max<Real>(
+        {min_y - node.center_of_mass_y, node.center_of_mass_y - max_y, 0.0f});
+    float size = node.boundary.half_dim * 2.0f;
+    if (size * size < theta_sq * (dx * dx + dy * dy)) {
+      list.add(node);
+      continue;
+    }
+
+    for (int i = node.first_body; i < node.first_body + node.body_count; ++i) {
+      list.add(body_x_[i], body_y_[i], body_mass_[i]);
+    }
+    if (node.first_child >= 0) {
+      for (int i = 3; i >= 0; --i) {
+        stack[stack_size++] = node.first_child + i;
+      }
+    }
+  }
+
+  // 3. Каждое тело группы суммирует тела и узлы списка за два прохода ядер.
+  // Вклад самого тела равен нулю, поэтому его не исключаем.
+  const KernelReal softening_sq = softening_factor * softening_factor;
+  const int body_count = static_cast<int>(list.mass.size());
+  const int node_count = static_cast<int>(list.node_mass.size());
+  stats.force_bodies += list.targets.size();
+  stats.interactions +=
+      static_cast<int64_t>(list.targets.size()) * (body_count + node_count);
+  for (int target : list.targets) {
+    KernelReal ax = 0.0f;
+    KernelReal ay = 0.0f;
+    accumulate_acceleration(body_x_[target], body_y_[target], list.x.data(),
+                            list.y.data(), list.mass.data(), body_count,
+                            softening_sq, ax, ay);
+    accumulate_quadrupole_acceleration(
+        body_x_[target], body_y_[target], list.node_x.data(),
+        list.node_y.data(), list.node_mass.data(), list.node_xx.data(),
+        list.node_xy.data(), list.node_yy.data(), node_count, softening_sq, ax,
+        ay);
+    CelestialBody* body = bodies_[target];
+    body->ax += G * ax;
+    body->ay += G * ay;
+  }
+}
+
+bool Quadtree::collect_visible_vertices(
+    const std::vector<CelestialBody>& bodies, const RenderView& view,
+    std::vector<BodyVertex>& vertices, std::vector<int>* ids) const {
+  if (!matches_bodies(bodies)) {
+    return false;
+  }
+  vertices.clear();
+  if (ids != nullptr) {
+    ids->clear();
+  }
+  const float min_x = view.min_x - view.margin;
+  const float max_x = view.max_x + view.margin;
+  const float min_y = view.min_y - view.margin;
+  const float max_y = view.max_y + view.margin;
+  const auto add_body = [&](const CelestialBody& body) {
+    const float x = static_cast<float>(body.x);
+    const float y = static_cast<float>(body.y);
+    if (x < min_x || x > max_x || y < min_y || y > max_y) {
+      return;
+    }
+    vertices.push_back({x, y, body.radius, body.radius});
+    if (ids != nullptr) {
+      ids->push_back(body.id);
+    }
+  };
+
+  int stack[256];
+  int stack_size = 0;
+  if (!nodes_.empty()) {
+    stack[stack_size++] = 0;
+  }
+  while (stack_size > 0) {
+    const int node_index = stack[--stack_size];
+    const QuadtreeNode& node = nodes_[node_index];
+    const Boundary& boundary = node.boundary;
+    if (boundary.x + boundary.half_dim < min_x ||
+        boundary.x - boundary.half_dim > max_x ||
+        boundary.y + boundary.half_dim < min_y ||
+        boundary.y - boundary.half_dim > max_y) {
+      continue;
+    }
+    if (2.0f * boundary.half_dim < view.pixel_size) {
+      append_lod_aggregate(node_index, vertices, ids);
+      continue;
+    }
+    for (int i = node.first_body; i < node.first_body + node.body_count; ++i) {
+      add_body(*bodies_[i]);
+    }
+    if (node.first_child >= 0) {
+      for (int i = 0; i < 4; ++i) {
+        stack[stack_size++] = node.first_child + i;
+      }
+    }
+  }
+  // Тела вне корня редки и далеки, их проверяют по одному и не объединяют
+  for (const CelestialBody* body : overflow_bodies_) {
+    add_body(*body);
+  }
+  return true;
+}
+
+void Quadtree::append_lod_aggregate(int node_index,
+                                    std::vector<BodyVertex>& vertices,
+                                    std::vector<int>* ids) const {
+  int count = 0;
+  int last_id = -1;
+  double mass = 0.0;
+  double mass_x = 0.0;
+  double mass_y = 0.0;
+  double volume = 0.0;  // сумма кубов радиусов, пропорциональна массе
+  float max_radius = 0.0f;
+
+  int stack[256];
+  int stack_size = 0;
+  stack[stack_size++] = node_index;
+  while (stack_size > 0) {
+    const QuadtreeNode& node = nodes_[stack[--stack_size]];
+    for (int i = node.first_body; i < node.first_body + node.body_count; ++i) {
+      const CelestialBody& body = *bodies_[i];
+      ++count;
+      last_id = body.id;
+      mass += body.mass;
+      mass_x += static_cast<double>(body.mass) * body.x;
+      mass_y += static_cast<double>(body.mass) * body.y;
+      volume += static_cast<double>(body.radius) * body.radius * body.radius;
+      max_radius = std::max(max_radius, body.radius);
+    }
+    if (node.first_child >= 0) {
+      for (int i = 0; i < 4; ++i) {
+        stack[stack_size++] = node.first_child + i;
+      }
+    }
+  }
+  if (count == 0 || mass <= 0.0) {
+    return;
+  }
+  vertices.push_back({static_cast<float>(mass_x / mass),
+                      static_cast<float>(mass_y / mass),
+                      static_cast<float>(std::cbrt(volume)), max_radius});
+  if (ids != nullptr) {
+    // Одно тело остаётся самим собой и интерполируется по id
+    ids->push_back(count == 1 ? last_id : -1);
+  }
 }
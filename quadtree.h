@@ -1,10 +1,19 @@
 #ifndef QUADTREE_H
 #define QUADTREE_H
 
-#include <memory>
+#include <cstdint>
 #include <vector>
 
-class CelestialBody;
+#include "aligned_allocator.h"
+#include "precision.h"
+
+struct BodyVertex;
+struct CelestialBody;
+class ThreadPool;
+
+// Тела дальше стольких средних расстояний от среднего положения тел не
+// попадают в дерево
+constexpr float kOverflowRadiusFactor = 8.0f;
 
 // Границы квадранта
 struct Boundary {
@@ -12,38 +21,220 @@ struct Boundary {
   float half_dim;  // половина размера
 };
 
+// Видимая часть плоскости для отбора тел при отрисовке
+struct RenderView {
+  float min_x, min_y, max_x, max_y;  // видимый прямоугольник
+  // Тела, центр которых ближе margin к прямоугольнику, тоже видимы: так
+  // учитываются радиус точки и смещение тел после построения дерева
+  float margin = 0.0f;
+  // Размер пикселя в единицах координат: тела узлов меньше пикселя
+  // объединяются в одну вершину (0 — не объединять)
+  float pixel_size = 0.0f;
+};
+
+// Узел квадродерева. Потомки лежат в общем массиве узлов подряд
+// (северо-запад, северо-восток, юго-запад, юго-восток), начиная с first_child.
+struct QuadtreeNode {
+  Boundary boundary;
+  int first_child = -1;  // -1, если узел не разделён
+  int first_body = 0;    // начало диапазона тел узла в общем массиве
+  int body_count = 0;    // количество тел, хранящихся в самом узле
+
+  // Распределение массы всего поддерева
+  int subtree_body_count = 0;
+  Real total_mass = 0.0f;
+  Real center_of_mass_x = 0.0f;
+  Real center_of_mass_y = 0.0f;
+  // Вторые моменты масс относительно центра масс для квадрупольной поправки
+  Real quadrupole_xx = 0.0f;
+  Real quadrupole_xy = 0.0f;
+  Real quadrupole_yy = 0.0f;
+};
+
+// Работа обходов дерева за вызов calculate_forces()
+struct ForceWalkStats {
+  int64_t force_bodies = 0;  // тел, получивших силы
+  int64_t node_visits = 0;   // узлов, просмотренных обходами групп
+  int64_t interactions = 0;  // слагаемых сил (тел и узлов) по всем телам
+};
+
+// Квадродерево хранит узлы и ссылки на тела в плоских массивах и
+// переиспользует их память между шагами: clear() не освобождает память, поэтому
+// после прогрева построение дерева не выделяет память.
+//
+// Дерево можно заполнять по одному телу через clear() и insert() либо целиком
+// через build(), который сортирует тела по кривой Мортона и строит дерево из
+// отсортированных диапазонов.
 class Quadtree {
  public:
   Quadtree(const Boundary& boundary, int capacity);
 
+  // Подбирает границы корня по телам перед build(). Границы охватывают все
+  // тела, кроме улетевших дальше kOverflowRadiusFactor средних расстояний от
+  // среднего положения, чтобы одно такое тело не растягивало дерево.
+  void fit_boundary(const std::vector<CelestialBody>& bodies, ThreadPool& pool);
+  // Переупорядочивает тела по ключам Мортона и строит дерево заново. Тела вне
+  // границ корня перемещаются в конец массива и в дерево не попадают, их
+  // гравитацию учитывает calculate_overflow_forces(). Ключи, сортировка и
+  // поддеревья ниже верхних уровней строятся в потоках pool; результат не
+  // зависит от их числа.
+  void build(std::vector<CelestialBody>& bodies, ThreadPool& pool);
+  // Обновляет дерево, построенное через build(), после смещения тех же тел,
+  // не меняя границ и узлов: тела, покинувшие свой лист, переходят в лист по
+  // новому положению, и тела переупорядочиваются сортировкой подсчётом по
+  // листьям. Возвращает false и ничего не меняет, если тела не те, что при
+  // построении, или дерево заметно испортилось: сместилась большая доля тел
+  // или какой-то лист переполнился. Тогда дерево нужно построить заново.
+  bool refit(std::vector<CelestialBody>& bodies);
+  // Удаляет тела с флагом collided, сохраняя порядок остальных. Если дерево
+  // построено по этим телам, диапазоны листьев сдвигаются вместе с телами, и
+  // refit() остаётся возможен после слияний.
+  void erase_collided(std::vector<CelestialBody>& bodies);
   void insert(CelestialBody* body);
   void query(const Boundary& range, std::vector<CelestialBody*>& found);
   void clear();
 
-  void compute_mass_distribution();
+  // Поддеревья, построенные build() отдельными задачами, считаются
+  // параллельно
+  void compute_mass_distribution(ThreadPool& pool);
   void calculate_force(CelestialBody& body, float theta, float G,
                        float softening_factor);
+  // Вычисляет силы для тел дерева с уровнем шага не меньше active_level (при
+  // 0 — для всех). Тела группами по несколько десятков обходят дерево вместе,
+  // и каждое тело группы затем за один проход ядра суммирует общий список
+  // взаимодействий из квадруполей далёких узлов и тел ближних узлов.
+  void calculate_forces(ThreadPool& pool, float theta, float G,
+                        float softening_factor, int active_level = 0);
+  // Добавляет силы, в которых участвуют тела вне корня: тела дерева суммируют
+  // их напрямую, а сами они обходят дерево и суммируют друг друга. Уровень
+  // active_level отбирает тела так же, как в calculate_forces().
+  void calculate_overflow_forces(ThreadPool& pool, float theta, float G,
+                                 float softening_factor, int active_level = 0);
+
+  // Вершины для отрисовки тел, видимых в view. Обход пропускает узлы вне
+  // прямоугольника, так что работа зависит от числа видимых тел. Узел меньше
+  // пикселя рисуется одной точкой в центре масс своих тел с радиусом, равным
+  // радиусу их суммарной массы, и цветом самого крупного тела, а тела крупных
+  // узлов — каждое своей вершиной. Число вершин так ограничено числом
+  // пикселей, а не тел. Узлы проверяются по границам из последнего build()
+  // или refit(), положения берутся текущие.
+  // В ids, если передан, пишется id тела каждой вершины или -1 для
+  // объединённой. Возвращает false и ничего не пишет, если дерево построено не
+  // по этим телам.
+  bool collect_visible_vertices(const std::vector<CelestialBody>& bodies,
+                                const RenderView& view,
+                                std::vector<BodyVertex>& vertices,
+                                std::vector<int>* ids = nullptr) const;
 
   // Для отладки
   const Boundary& get_boundary() const { return boundary_; }
-  const std::vector<std::unique_ptr<Quadtree>>& get_children() const;
+  const std::vector<QuadtreeNode>& get_nodes() const { return nodes_; }
+  int get_body_count() const { return static_cast<int>(bodies_.size()); }
+  int get_overflow_count() const {
+    return static_cast<int>(overflow_bodies_.size());
+  }
+  // Глубина дерева, построенного через build()
+  int get_depth() const { return depth_; }
+  const ForceWalkStats& get_force_stats() const { return force_stats_; }
 
  private:
+  friend class FmmSolver;
+
   Boundary boundary_;
   int capacity_;
-  std::vector<CelestialBody*> bodies_;
-  bool divided_ = false;
+  // Тела хранятся только в листьях (дерево построено через build())
+  bool leaf_bodies_only_ = false;
+  std::vector<QuadtreeNode> nodes_;              // узел 0 — корень
+  std::vector<CelestialBody*> bodies_;           // тела узлов
+  std::vector<CelestialBody*> overflow_bodies_;  // тела вне корня
+  // Листья в порядке их диапазонов тел и номер листа для каждого узла
+  // (-1 для внутренних), заполняются в build()
+  std::vector<int> leaf_nodes_;
+  std::vector<int> node_leaf_;
+
+  // Горячие поля тел в формате SoA, в том же порядке, что и bodies_.
+  // Заполняются в compute_mass_distribution() и читаются ядрами сил.
+  AlignedVector<KernelReal> body_x_;
+  AlignedVector<KernelReal> body_y_;
+  AlignedVector<KernelReal> body_mass_;
+  AlignedVector<KernelReal> overflow_x_;
+  AlignedVector<KernelReal> overflow_y_;
+  AlignedVector<KernelReal> overflow_mass_;
+
+  // Частичные суммы для границ корня по блокам тел фиксированного размера
+  struct BoundsBlock {
+    double sum_x, sum_y, sum_distance;
+    Real min_x, max_x, min_y, max_y;
+  };
+  std::vector<BoundsBlock> bounds_blocks_;
+
+  // Группа тел, вместе обходящих дерево при расчёте сил: всё поддерево узла
+  // или только тела, хранящиеся в самом узле
+  struct ForceGroup {
+    int node_index;
+    bool whole_subtree;
+  };
+  std::vector<ForceGroup> force_groups_;
+  // Работа обходов по блокам групп, складывается в force_stats_
+  std::vector<ForceWalkStats> chunk_stats_;
+  ForceWalkStats force_stats_;
+  int depth_ = 0;
 
-  float total_mass_ = 0.0f;
-  float center_of_mass_x_ = 0.0f;
-  float center_of_mass_y_ = 0.0f;
+  // Буферы построения по кривой Мортона, переиспользуемые между шагами
+  std::vector<uint32_t> keys_;
+  std::vector<uint32_t> sorted_keys_;
+  std::vector<int> order_;
+  std::vector<int> sorted_order_;
+  std::vector<CelestialBody> body_scratch_;
+  std::vector<int> block_starts_;   // начала блоков тел внутри и вне корня
+  std::vector<int> digit_offsets_;  // смещения разрядов по блокам
+  std::vector<int> leaf_scratch_;
 
-  std::unique_ptr<Quadtree> northwest_;
-  std::unique_ptr<Quadtree> northeast_;
-  std::unique_ptr<Quadtree> southwest_;
-  std::unique_ptr<Quadtree> southeast_;
+  // Поддерево, которое build() строит отдельной задачей: его узлы нумеруются
+  // в своём массиве (узел 0 — копия корня) и затем переносятся в nodes_ с
+  // номера offset
+  struct SubtreeBuild {
+    int root;
+    int begin, end, level;
+    int offset;
+    int depth;
+    std::vector<QuadtreeNode> nodes;
+    std::vector<int> leaves;
+  };
+  // Первые subtree_count_ записей действительны, память остальных
+  // переиспользуется
+  std::vector<SubtreeBuild> subtree_builds_;
+  int subtree_count_ = 0;
+  // Узлы верхней части дерева из build() идут первыми, узлы поддеревьев — за
+  // ними
+  int top_node_count_ = 0;
+  // Буферы refit(): лист каждого тела и начала диапазонов листьев
+  std::vector<int> body_leaves_;
+  std::vector<int> leaf_starts_;
 
-  void subdivide();
+  int add_node(const Boundary& boundary);
+  void sort_by_morton_key(int count, ThreadPool& pool);
+  // Строит узел из отсортированного диапазона тел. Узел, который ещё надо
+  // делить, но в котором не больше max_subtree_bodies тел, откладывается в
+  // subtree_builds_ (-1 — строить всё поддерево сразу).
+  void build_node(std::vector<QuadtreeNode>& nodes, std::vector<int>& leaves,
+                  int& depth, int node_index, int begin, int end, int level,
+                  int max_subtree_bodies);
+  bool matches_bodies(const std::vector<CelestialBody>& bodies) const;
+  int find_leaf(const CelestialBody& body) const;
+  void assign_body_pointers(std::vector<CelestialBody>& bodies, int inside);
+  bool insert(int node_index, CelestialBody* body);
+  void query(int node_index, const Boundary& range,
+             std::vector<CelestialBody*>& found);
+  // top_only — не спускаться в поддеревья, посчитанные отдельно
+  void compute_mass_distribution(int node_index, bool top_only);
+  void collect_force_groups(int node_index);
+  // Добавляет одну вершину для всех тел поддерева узла
+  void append_lod_aggregate(int node_index, std::vector<BodyVertex>& vertices,
+                            std::vector<int>* ids) const;
+  void calculate_group_force(const ForceGroup& group, float theta, float G,
+                             float softening_factor, int active_level,
+                             ForceWalkStats& stats);
 };
 
 #endif  // QUADTREE_H
@@ -2,6 +2,8 @@
 
 #include <GLES3/gl3.h>
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -49,12 +51,15 @@ bool Renderer::init(float initialization_radius) {
 
   body_pos_attrib_loc = glGetAttribLocation(shader_program, "a_body_pos");
   body_radius_attrib_loc = glGetAttribLocation(shader_program, "a_body_radius");
+  color_radius_attrib_loc =
+      glGetAttribLocation(shader_program, "a_color_radius");
   resolution_uniform_loc = glGetUniformLocation(shader_program, "u_resolution");
 
   num_bodies_uniform_loc = glGetUniformLocation(shader_program, "u_num_bodies");
   initialization_radius_uniform_loc =
       glGetUniformLocation(shader_program, "u_initialization_radius");
   zoom_uniform_loc = glGetUniformLocation(shader_program, "u_zoom");
+  center_uniform_loc = glGetUniformLocation(shader_program, "u_center");
   min_radius_uniform_loc = glGetUniformLocation(shader_program, "u_min_radius");
   max_radius_uniform_loc = glGetUniformLocation(shader_program, "u_max_radius");
   num_colors_uniform_loc = glGetUniformLocation(shader_program, "u_num_colors");
@@ -65,6 +70,11 @@ bool Renderer::init(float initialization_radius) {
                                      touchstart_callback);
   emscripten_set_touchmove_callback("#canvas", this, true, touchmove_callback);
   emscripten_set_touchend_callback("#canvas", this, true, touchend_callback);
+  emscripten_set_mousedown_callback("#canvas", this, true, mouse_callback);
+  emscripten_set_mousemove_callback("#canvas", this, true, mouse_callback);
+  emscripten_set_mouseup_callback("#canvas", this, true, mouse_callback);
+  emscripten_set_dblclick_callback("#canvas", this, true, mouse_callback);
+  emscripten_set_wheel_callback("#canvas", this, true, wheel_callback);
 
   glViewport(0, 0, screen_width, screen_height);
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -72,34 +82,40 @@ bool Renderer::init(float initialization_radius) {
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  glGenVertexArrays(1, &particle_vao);
-  glBindVertexArray(particle_vao);
-
-  glGenBuffers(1, &particle_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, particle_vbo);
-
-  glEnableVertexAttribArray(body_pos_attrib_loc);
-  glVertexAttribPointer(body_pos_attrib_loc, 2, GL_FLOAT, GL_FALSE,
-                        sizeof(CelestialBody),
-                        (void *)offsetof(CelestialBody, x));
-
-  glEnableVertexAttribArray(body_radius_attrib_loc);
-  glVertexAttribPointer(body_radius_attrib_loc, 1, GL_FLOAT, GL_FALSE,
-                        sizeof(CelestialBody),
-                        (void *)offsetof(CelestialBody, radius));
+  glGenVertexArrays(kVertexBufferCount, particle_vaos);
+  glGenBuffers(kVertexBufferCount, particle_vbos);
+  for (int i = 0; i < kVertexBufferCount; ++i) {
+    glBindVertexArray(particle_vaos[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, particle_vbos[i]);
+
+    glEnableVertexAttribArray(body_pos_attrib_loc);
+    glVertexAttribPointer(body_pos_attrib_loc, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(BodyVertex), (void *)offsetof(BodyVertex, x));
+
+    glEnableVertexAttribArray(body_radius_attrib_loc);
+    glVertexAttribPointer(body_radius_attrib_loc, 1, GL_FLOAT, GL_FALSE,
+                          sizeof(BodyVertex),
+                          (void *)offsetof(BodyVertex, radius));
+
+    glEnableVertexAttribArray(color_radius_attrib_loc);
+    glVertexAttribPointer(color_radius_attrib_loc, 1, GL_FLOAT, GL_FALSE,
+                          sizeof(BodyVertex),
+                          (void *)offsetof(BodyVertex, color_radius));
+  }
 
   glBindVertexArray(0);
 
   return true;
 }
 
-void Renderer::render(const std::vector<CelestialBody> &bodies,
+void Renderer::render(const std::vector<BodyVertex> &vertices,
                       float min_radius, float max_radius) {
   glClear(GL_COLOR_BUFFER_BIT);
 
   glUniform1f(initialization_radius_uniform_loc, initialization_radius);
   glUniform2f(resolution_uniform_loc, screen_width, screen_height);
   glUniform1f(zoom_uniform_loc, zoom);
+  glUniform2f(center_uniform_loc, center_x, center_y);
   glUniform1f(min_radius_uniform_loc, min_radius);
   glUniform1f(max_radius_uniform_loc, max_radius);
 
@@ -107,12 +123,22 @@ void Renderer::render(const std::vector<CelestialBody> &bodies,
   glUniform3fv(colors_uniform_loc, colors.size(), (GLfloat *)colors.data());
   glUniform1fv(weights_uniform_loc, weights.size(), weights.data());
 
-  glBindVertexArray(particle_vao);
-  glBindBuffer(GL_ARRAY_BUFFER, particle_vbo);
-  glBufferData(GL_ARRAY_BUFFER, bodies.size() * sizeof(CelestialBody),
-               bodies.data(), GL_DYNAMIC_DRAW);
+  current_vbo = (current_vbo + 1) % kVertexBufferCount;
+  glBindVertexArray(particle_vaos[current_vbo]);
+  glBindBuffer(GL_ARRAY_BUFFER, particle_vbos[current_vbo]);
+  // Память буфера выделяется заново только при росте числа тел, с запасом
+  size_t &capacity = vbo_capacities[current_vbo];
+  if (vertices.size() > capacity) {
+    capacity = std::max(vertices.size(), capacity * 2);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(BodyVertex), nullptr,
+                 GL_DYNAMIC_DRAW);
+  }
+  if (!vertices.empty()) {
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(BodyVertex),
+                    vertices.data());
+  }
 
-  glDrawArrays(GL_POINTS, 0, bodies.size());
+  glDrawArrays(GL_POINTS, 0, vertices.size());
 
   glBindVertexArray(0);
 }
@@ -121,7 +147,48 @@ void Renderer::set_initialization_radius(float radius) {
   this->initialization_radius = radius;
 }
 
-void Renderer::reset_zoom() { this->zoom = 1.0f; }
+void Renderer::reset_view() {
+  zoom = 1.0f;
+  center_x = 0.0f;
+  center_y = 0.0f;
+}
+
+// Шейдер отображает initialization_radius на половину меньшей стороны экрана
+float Renderer::get_pixel_size() const {
+  const int resolution = std::max(std::min(screen_width, screen_height), 1);
+  return 2.0f * initialization_radius / (zoom * resolution);
+}
+
+RenderView Renderer::get_view() const {
+  const float pixel_size = get_pixel_size();
+  const float half_width = 0.5f * screen_width * pixel_size;
+  const float half_height = 0.5f * screen_height * pixel_size;
+  RenderView view;
+  view.min_x = center_x - half_width;
+  view.max_x = center_x + half_width;
+  view.min_y = center_y - half_height;
+  view.max_y = center_y + half_height;
+  view.pixel_size = pixel_size;
+  return view;
+}
+
+void Renderer::pan(double dx, double dy) {
+  // Ось y экрана направлена вниз, а координат тел — вверх
+  const float pixel_size = get_pixel_size();
+  center_x -= dx * pixel_size;
+  center_y += dy * pixel_size;
+}
+
+void Renderer::zoom_at(double factor, double x, double y) {
+  const double offset_x = x - 0.5 * screen_width;
+  const double offset_y = y - 0.5 * screen_height;
+  // Точка под указателем до и после смены масштаба
+  const float point_x = center_x + offset_x * get_pixel_size();
+  const float point_y = center_y - offset_y * get_pixel_size();
+  zoom *= factor;
+  center_x = point_x - offset_x * get_pixel_size();
+  center_y = point_y + offset_y * get_pixel_size();
+}
 
 void Renderer::set_colors(const std::vector<float> &color_data,
                           const std::vector<float> &weight_data) {
@@ -238,24 +305,124 @@ void Renderer::handle_touchstart(const EmscriptenTouchEvent *touchEvent) {
   if (touchEvent->numTouches >= 2) {
     const EmscriptenTouchPoint *t1 = &touchEvent->touches[0];
     const EmscriptenTouchPoint *t2 = &touchEvent->touches[1];
-    initial_touch_dist = std::sqrt(std::pow(t1->clientX - t2->clientX, 2) +
-                                   std::pow(t1->clientY - t2->clientY, 2));
+    initial_touch_dist = std::sqrt(std::pow(t1->targetX - t2->targetX, 2) +
+                                   std::pow(t1->targetY - t2->targetY, 2));
+    last_pointer_x = 0.5 * (t1->targetX + t2->targetX);
+    last_pointer_y = 0.5 * (t1->targetY + t2->targetY);
+  } else if (touchEvent->numTouches == 1) {
+    last_pointer_x = touchEvent->touches[0].targetX;
+    last_pointer_y = touchEvent->touches[0].targetY;
   }
 }
 
+// Одно касание сдвигает вид, два — масштабируют его вокруг середины между
+// ними и сдвигают вслед за ней
 void Renderer::handle_touchmove(const EmscriptenTouchEvent *touchEvent) {
   if (touchEvent->numTouches >= 2) {
     const EmscriptenTouchPoint *t1 = &touchEvent->touches[0];
     const EmscriptenTouchPoint *t2 = &touchEvent->touches[1];
     double current_touch_dist =
-        std::sqrt(std::pow(t1->clientX - t2->clientX, 2) +
-                  std::pow(t1->clientY - t2->clientY, 2));
-    zoom *=
-        1.0 + (current_touch_dist - initial_touch_dist) / initial_touch_dist;
+        std::sqrt(std::pow(t1->targetX - t2->targetX, 2) +
+                  std::pow(t1->targetY - t2->targetY, 2));
+    const double middle_x = 0.5 * (t1->targetX + t2->targetX);
+    const double middle_y = 0.5 * (t1->targetY + t2->targetY);
+    if (initial_touch_dist > 0) {
+      zoom_at(current_touch_dist / initial_touch_dist, last_pointer_x,
+              last_pointer_y);
+    }
+    pan(middle_x - last_pointer_x, middle_y - last_pointer_y);
     initial_touch_dist = current_touch_dist;
+    last_pointer_x = middle_x;
+    last_pointer_y = middle_y;
+  } else if (touchEvent->numTouches == 1) {
+    const EmscriptenTouchPoint *t = &touchEvent->touches[0];
+    pan(t->targetX - last_pointer_x, t->targetY - last_pointer_y);
+    last_pointer_x = t->targetX;
+    last_pointer_y = t->targetY;
   }
 }
 
 void Renderer::handle_touchend(const EmscriptenTouchEvent *touchEvent) {
   initial_touch_dist = 0;
+  // Оставшееся касание продолжает сдвиг от своего положения
+  for (int i = 0; i < touchEvent->numTouches; ++i) {
+    const EmscriptenTouchPoint *t = &touchEvent->touches[i];
+    if (!t->isChanged) {
+      last_pointer_x = t->targetX;
+      last_pointer_y = t->targetY;
+    }
+  }
+}
+
+EM_BOOL Renderer::mouse_callback(int eventType,
+                                 const EmscriptenMouseEvent *mouseEvent,
+                                 void *userData) {
+  Renderer *renderer = static_cast<Renderer *>(userData);
+  if (!renderer) {
+    return EM_FALSE;
+  }
+  switch (eventType) {
+    case EMSCRIPTEN_EVENT_MOUSEDOWN:
+      renderer->handle_mousedown(mouseEvent);
+      return EM_TRUE;
+    case EMSCRIPTEN_EVENT_MOUSEMOVE:
+      renderer->handle_mousemove(mouseEvent);
+      // Движение без перетаскивания остаётся странице, она показывает по
+      // нему панель
+      return renderer->mouse_dragging ? EM_TRUE : EM_FALSE;
+    case EMSCRIPTEN_EVENT_MOUSEUP:
+      renderer->handle_mouseup(mouseEvent);
+      return EM_TRUE;
+    case EMSCRIPTEN_EVENT_DBLCLICK:
+      renderer->reset_view();
+      return EM_TRUE;
+  }
+  return EM_FALSE;
+}
+
+EM_BOOL Renderer::wheel_callback(int eventType,
+                                 const EmscriptenWheelEvent *wheelEvent,
+                                 void *userData) {
+  Renderer *renderer = static_cast<Renderer *>(userData);
+  if (renderer) {
+    renderer->handle_wheel(wheelEvent);
+  }
+  return EM_TRUE;
+}
+
+void Renderer::handle_mousedown(const EmscriptenMouseEvent *mouseEvent) {
+  if (mouseEvent->button == 0) {
+    mouse_dragging = true;
+    last_pointer_x = mouseEvent->targetX;
+    last_pointer_y = mouseEvent->targetY;
+  }
+}
+
+void Renderer::handle_mousemove(const EmscriptenMouseEvent *mouseEvent) {
+  // Кнопку могли отпустить за пределами холста
+  if (!mouse_dragging || (mouseEvent->buttons & 1) == 0) {
+    mouse_dragging = false;
+    return;
+  }
+  pan(mouseEvent->targetX - last_pointer_x,
+      mouseEvent->targetY - last_pointer_y);
+  last_pointer_x = mouseEvent->targetX;
+  last_pointer_y = mouseEvent->targetY;
+}
+
+void Renderer::handle_mouseup(const EmscriptenMouseEvent *mouseEvent) {
+  mouse_dragging = false;
+}
+
+// Колесо масштабирует вид вокруг указателя, на щелчок колеса (около 100
+// пикселей прокрутки) примерно в 1.2 раза
+void Renderer::handle_wheel(const EmscriptenWheelEvent *wheelEvent) {
+  double delta = wheelEvent->deltaY;
+  if (wheelEvent->deltaMode == DOM_DELTA_LINE) {
+    delta *= 33.0;
+  } else if (wheelEvent->deltaMode == DOM_DELTA_PAGE) {
+    delta *= screen_height;
+  }
+  zoom_at(std::exp(-delta * 0.0018), wheelEvent->mouse.targetX,
+          wheelEvent->mouse.targetY);
 }
@@ -15,16 +15,25 @@ class Renderer {
   ~Renderer();
 
   bool init(float initialization_radius);
-  void render(const std::vector<CelestialBody> &bodies, float min_radius,
+  void render(const std::vector<BodyVertex> &vertices, float min_radius,
               float max_radius);
   void handle_resize(int width, int height);
   void handle_touchstart(const EmscriptenTouchEvent *touchEvent);
   void handle_touchmove(const EmscriptenTouchEvent *touchEvent);
   void handle_touchend(const EmscriptenTouchEvent *touchEvent);
+  void handle_mousedown(const EmscriptenMouseEvent *mouseEvent);
+  void handle_mousemove(const EmscriptenMouseEvent *mouseEvent);
+  void handle_mouseup(const EmscriptenMouseEvent *mouseEvent);
+  void handle_wheel(const EmscriptenWheelEvent *wheelEvent);
   void set_colors(const std::vector<float> &color_data,
                   const std::vector<float> &weight_data);
   void set_initialization_radius(float radius);
-  void reset_zoom();
+  // Возвращает масштаб и центр вида к исходным
+  void reset_view();
+  // Размер пикселя экрана в единицах координат тел при текущем масштабе
+  float get_pixel_size() const;
+  // Видимый прямоугольник при текущих масштабе и сдвиге, без запаса
+  RenderView get_view() const;
 
  private:
   int screen_width;
@@ -32,6 +41,14 @@ class Renderer {
   float initialization_radius;
   double initial_touch_dist = 0;
   float zoom = 1.0;
+  // Центр вида в координатах тел; вид сдвигается перетаскиванием
+  float center_x = 0.0f;
+  float center_y = 0.0f;
+  // Последнее положение указателя (или середины между двумя касаниями) в
+  // пикселях холста для сдвига вида
+  double last_pointer_x = 0;
+  double last_pointer_y = 0;
+  bool mouse_dragging = false;
 
   struct Color {
     float r, g, b;
@@ -44,20 +61,31 @@ class Renderer {
   GLint num_bodies_uniform_loc;
   GLint initialization_radius_uniform_loc;
   GLint zoom_uniform_loc;
+  GLint center_uniform_loc;
   GLint min_radius_uniform_loc;
   GLint max_radius_uniform_loc;
   GLint num_colors_uniform_loc;
   GLint colors_uniform_loc;
   GLint weights_uniform_loc;
 
-  GLuint particle_vbo;
-  GLuint particle_vao;
+  // Два буфера вершин по очереди: пока GPU рисует из одного, второй
+  // обновляется через glBufferSubData без ожидания
+  static constexpr int kVertexBufferCount = 2;
+  GLuint particle_vbos[kVertexBufferCount];
+  GLuint particle_vaos[kVertexBufferCount];
+  size_t vbo_capacities[kVertexBufferCount] = {};  // в вершинах
+  int current_vbo = 0;
   GLint body_pos_attrib_loc;
   GLint body_radius_attrib_loc;
+  GLint color_radius_attrib_loc;
 
   GLuint load_shader(GLenum type, const char *source);
   GLuint create_shader_program(const char *vs_source, const char *fs_source);
   std::string read_file(const std::string &path);
+  // Сдвигает вид вслед за указателем, смещённым на (dx, dy) пикселей
+  void pan(double dx, double dy);
+  // Меняет масштаб в factor раз, не сдвигая точку под пикселем (x, y)
+  void zoom_at(double factor, double x, double y);
 
   static EM_BOOL touchstart_callback(int eventType,
                                      const EmscriptenTouchEvent *touchEvent,
@@ -68,6 +96,12 @@ class Renderer {
   static EM_BOOL touchend_callback(int eventType,
                                    const EmscriptenTouchEvent *touchEvent,
                                    void *userData);
+  static EM_BOOL mouse_callback(int eventType,
+                                const EmscriptenMouseEvent *mouseEvent,
+                                void *userData);
+  static EM_BOOL wheel_callback(int eventType,
+                                const EmscriptenWheelEvent *wheelEvent,
+                                void *userData);
 };
 
 #endif  // RENDERER_H
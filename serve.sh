@@ -1,2 +1,18 @@
 #!/bin/bash
-python -m http.server --directory public
+# Заголовки COOP/COEP включают SharedArrayBuffer для многопоточной сборки
+python3 - <<'PY'
+from functools import partial
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Handler(SimpleHTTPRequestHandler):
+    def end_headers(self):
+        self.send_header("Cross-Origin-Opener-Policy", "same-origin")
+        self.send_header("Cross-Origin-Embedder-Policy", "require-corp")
+        super().end_headers()
+
+
+server = ThreadingHTTPServer(("", 8000), partial(Handler, directory="public"))
+print("Serving on http://localhost:8000")
+server.serve_forever()
+PY
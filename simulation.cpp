@@ -1,52 +1,18 @@
+#include "simulation.h"
+
 #include <algorithm>
 #include <chrono>
 #include <cmath>
-#include <functional>
-#include <iostream>
+#include <cstring>
 #include <random>
 #include <vector>
-#ifdef __EMSCRIPTEN__
-#include <emscripten.h>
-#include <emscripten/bind.h>
-#include <emscripten/html5.h>
-#endif
-#include "quadtree.h"
-#include "renderer.h"
-#include "simulation.h"
-
-struct SimulationContext {
-  Renderer* renderer;
-  std::vector<CelestialBody>* bodies;
-  SimulationParameters* params;
-  Quadtree** quadtree;
-};
-
-#ifdef __EMSCRIPTEN__
-// Global context for the callback
-SimulationContext* g_context = nullptr;
-
-EM_BOOL on_web_display_size_changed(int event_type,
-                                    const EmscriptenUiEvent* ui_event,
-                                    void* user_data) {
-  double width, height;
-  emscripten_get_element_css_size("canvas", &width, &height);
-  emscripten_set_canvas_element_size("#canvas", (int)width, (int)height);
-  if (g_context && g_context->renderer) {
-    g_context->renderer->handle_resize((int)width, (int)height);
-  }
-  return EM_TRUE;
-}
-#endif
-
-bool stateLoaded = false;
-
-bool isStateLoaded() { return stateLoaded; }
 
-void markStateAsLoaded() { stateLoaded = true; }
+#include "quadtree.h"
 
 // Функция для инициализации небесных тел
 void initialize_bodies(std::vector<CelestialBody>& bodies,
-                       const SimulationParameters& params) {
+                       const SimulationParameters& params,
+                       std::mt19937& generator) {
   bodies.clear();  // Очищаем существующие тела
 
   // Центральный объект
@@ -60,9 +26,7 @@ void initialize_bodies(std::vector<CelestialBody>& bodies,
   central_body.radius = std::cbrt(central_body.mass / params.DENSITY);
   bodies.push_back(central_body);
 
-  // Настройка генератора случайных чисел
-  unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::mt19937 generator(seed);
+  // Настройка распределений случайных чисел
   std::uniform_real_distribution<float> dist_uniform_0_1(0.0f, 1.0f);
   std::uniform_real_distribution<float> dist_angle(0.0f, 2.0f * M_PI);
   std::uniform_real_distribution<float> dist_mass(params.MIN_MASS,
@@ -96,259 +60,417 @@ void initialize_bodies(std::vector<CelestialBody>& bodies,
   }
 }
 
-// Функция для обновления состояния симуляции на один шаг
-void update_simulation(std::vector<CelestialBody>& bodies, Quadtree& qtree,
+void initialize_bodies(std::vector<CelestialBody>& bodies,
                        const SimulationParameters& params) {
-  // 1. Очищаем и строим квадродерево
-  qtree.clear();
-  for (auto& body : bodies) {
-    qtree.insert(&body);
-  }
+  std::mt19937 generator(get_random_seed(params));
+  initialize_bodies(bodies, params, generator);
+}
 
-  // 2. Проверка столкновений и слияние (с использованием квадродерева)
-  for (auto& body_i : bodies) {
-    if (body_i.collided) continue;
-
-    std::vector<CelestialBody*> potential_colliders;
-    Boundary query_range = {body_i.x, body_i.y, body_i.radius * 2.0f};
-    qtree.query(query_range, potential_colliders);
-
-    for (CelestialBody* body_j : potential_colliders) {
-      if (body_i.id >= body_j->id) continue;
-      if (body_j->collided) continue;
-
-      float dx = body_j->x - body_i.x;
-      float dy = body_j->y - body_i.y;
-      float dist = std::sqrt(dx * dx + dy * dy);
-
-      if (dist < body_i.radius + body_j->radius) {
-        CelestialBody* smaller =
-            (body_i.radius < body_j->radius) ? &body_i : body_j;
-        CelestialBody* larger =
-            (body_i.radius < body_j->radius) ? body_j : &body_i;
-
-        // Сохранение импульса
-        float total_mass = larger->mass + smaller->mass;
-        larger->vx = (larger->vx * larger->mass + smaller->vx * smaller->mass) /
-                     total_mass;
-        larger->vy = (larger->vy * larger->mass + smaller->vy * smaller->mass) /
-                     total_mass;
-
-        // Обновление массы и радиуса
-        larger->mass = total_mass;
-        larger->radius = std::cbrt(larger->mass / params.DENSITY);
-
-        smaller->collided = true;
-      }
-    }
+uint32_t get_random_seed(const SimulationParameters& params) {
+  if (params.SEED != 0) {
+    return static_cast<uint32_t>(params.SEED);
   }
+  return static_cast<uint32_t>(
+      std::chrono::system_clock::now().time_since_epoch().count());
+}
 
-  // 3. Удаление "слипшихся" тел
-  bodies.erase(
-      std::remove_if(bodies.begin(), bodies.end(),
-                     [](const CelestialBody& body) { return body.collided; }),
-      bodies.end());
+namespace {
 
-  // 4. Сброс ускорений
-  for (auto& body : bodies) {
-    body.ax = 0.0f;
-    body.ay = 0.0f;
-  }
+template <typename T>
+uint64_t to_bits(T value) {
+  static_assert(sizeof(T) <= sizeof(uint64_t), "value must fit 64 bits");
+  uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(T));
+  return bits;
+}
 
-  // 5. Вычисление сил и ускорений (с использованием алгоритма Барнса-Хата)
-  qtree.compute_mass_distribution();
-  for (auto& body : bodies) {
-    qtree.calculate_force(body, params.THETA, params.G,
-                          params.SOFTENING_FACTOR);
+}  // namespace
+
+uint64_t hash_bodies(const std::vector<CelestialBody>& bodies) {
+  // FNV-1a по 64-битным словам с досмешиванием старших битов в младшие
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](uint64_t word) {
+    hash = (hash ^ word) * 1099511628211ull;
+    hash ^= hash >> 29;
+  };
+  mix(bodies.size());
+  for (const CelestialBody& body : bodies) {
+    mix(to_bits(body.id));
+    mix(to_bits(body.x));
+    mix(to_bits(body.y));
+    mix(to_bits(body.vx));
+    mix(to_bits(body.vy));
+    mix(to_bits(body.mass));
+    mix(to_bits(body.radius));
   }
+  return hash;
+}
 
-  // 6. Обновление скоростей и положений
-  for (auto& body : bodies) {
-    body.vx += body.ax * params.DT;
-    body.vy += body.ay * params.DT;
-    body.x += body.vx * params.DT;
-    body.y += body.vy * params.DT;
+void write_body_vertices(const std::vector<CelestialBody>& bodies,
+                         std::vector<BodyVertex>& vertices) {
+  vertices.resize(bodies.size());
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    const CelestialBody& body = bodies[i];
+    vertices[i] = {static_cast<float>(body.x), static_cast<float>(body.y),
+                   body.radius, body.radius};
   }
 }
 
-// Глобальные переменные для симуляции
-std::vector<CelestialBody> g_bodies;
-SimulationParameters g_params;
-Renderer* g_renderer = nullptr;
-int g_simulation_speed = 1;
-Quadtree* g_quadtree = nullptr;
+void pack_bodies(const std::vector<CelestialBody>& bodies,
+                 std::vector<float>& packed) {
+  packed.resize(bodies.size() * kPackedBodyWords);
+  float* out = packed.data();
+  for (const CelestialBody& body : bodies) {
+    out[0] = body.x;
+    out[1] = body.y;
+    out[2] = body.vx;
+    out[3] = body.vy;
+    out[4] = body.mass;
+    std::memcpy(&out[5], &body.id, sizeof(float));
+    out[6] = body.radius;
+    out += kPackedBodyWords;
+  }
+}
 
-void reset_simulation();
+void unpack_bodies(const float* packed, int body_count,
+                   std::vector<CelestialBody>& bodies) {
+  bodies.resize(body_count);
+  for (CelestialBody& body : bodies) {
+    body = CelestialBody();
+    body.x = packed[0];
+    body.y = packed[1];
+    body.vx = packed[2];
+    body.vy = packed[3];
+    body.mass = packed[4];
+    std::memcpy(&body.id, &packed[5], sizeof(int));
+    body.radius = packed[6];
+    packed += kPackedBodyWords;
+  }
+}
 
-// Функция для сброса симуляции
-void reset_simulation_to_defaults() {
-  g_params = SimulationParameters();
-  reset_simulation();
+namespace {
+
+// Добавляет слияния в events и возвращает их число
+int merge_colliding_bodies(std::vector<CelestialBody>& bodies,
+                           BroadPhase& broad_phase,
+                           const SimulationParameters& params, int64_t step,
+                           std::vector<MergeEvent>& events) {
+  int merge_count = 0;
+  for (const CollisionPair& pair : broad_phase.find_overlapping_pairs(bodies)) {
+    CelestialBody& body_i = bodies[pair.first];
+    CelestialBody& body_j = bodies[pair.second];
+    if (body_i.collided || body_j.collided) continue;
+
+    // Пары идут по возрастанию id, body_i — тело с меньшим id; при равных
+    // радиусах оно и поглощает
+    CelestialBody* smaller = (body_i.radius < body_j.radius) ? &body_i : &body_j;
+    CelestialBody* larger = (body_i.radius < body_j.radius) ? &body_j : &body_i;
+
+    // Сохранение импульса
+    float total_mass = larger->mass + smaller->mass;
+    larger->vx =
+        (larger->vx * larger->mass + smaller->vx * smaller->mass) / total_mass;
+    larger->vy =
+        (larger->vy * larger->mass + smaller->vy * smaller->mass) / total_mass;
+
+    // Обновление массы и радиуса
+    larger->mass = total_mass;
+    larger->radius = std::cbrt(larger->mass / params.DENSITY);
+
+    smaller->collided = true;
+    events.push_back({larger->id, smaller->id, step});
+    ++merge_count;
+  }
+  return merge_count;
 }
 
-void reset_simulation() {
-  initialize_bodies(g_bodies, g_params);
-  if (g_quadtree) {
-    delete g_quadtree;
+// Наименьший уровень, блок которого начинается в тике: тик делится на длину
+// блока 2^(max_level - level). В тике 0 начинаются блоки всех уровней.
+int first_active_level(int tick, int max_level) {
+  if (tick == 0) {
+    return 0;
+  }
+  int trailing_zeros = 0;
+  while ((tick & 1) == 0) {
+    tick >>= 1;
+    ++trailing_zeros;
   }
-  Boundary boundary = {0.0f, 0.0f, g_params.INITIALIZATION_RADIUS * 2.0f};
-  g_quadtree = new Quadtree(boundary, 4);
+  return max_level - trailing_zeros;
 }
 
-#ifdef __EMSCRIPTEN__
-void main_loop(void* arg) {
-  SimulationContext* context = static_cast<SimulationContext*>(arg);
-  for (int i = 0; i < g_simulation_speed; ++i) {
-    update_simulation(*context->bodies, **context->quadtree, *context->params);
+bool has_bodies_at_level(const int* level_counts, int min_level) {
+  for (int level = min_level; level <= kMaxTimestepLevel; ++level) {
+    if (level_counts[level] > 0) {
+      return true;
+    }
   }
-  float min_radius = std::cbrt(
-      std::min(context->params->MIN_MASS, context->params->CENTRAL_BODY_MASS) /
-      context->params->DENSITY);
-  float max_radius = std::cbrt(
-      std::max(context->params->MAX_MASS, context->params->CENTRAL_BODY_MASS) /
-      context->params->DENSITY);
-  context->renderer->render(*context->bodies, min_radius, max_radius);
+  return false;
 }
-#endif
 
-int main(int argc, char* argv[]) {
-  if (!isStateLoaded()) {
-    reset_simulation();
+// Уровень, при котором шаг DT / 2^level не превышает
+// TIMESTEP_ACCURACY * sqrt(SOFTENING_FACTOR / |a|)
+int choose_timestep_level(const CelestialBody& body,
+                          const SimulationParameters& params, int max_level) {
+  float acceleration = std::sqrt(body.ax * body.ax + body.ay * body.ay);
+  float ratio = params.DT * std::sqrt(acceleration / params.SOFTENING_FACTOR) /
+                params.TIMESTEP_ACCURACY;
+  int level = 0;
+  while (ratio > 1.0f && level < max_level) {
+    ratio *= 0.5f;
+    ++level;
   }
+  return level;
+}
 
-  int width, height;
-#ifdef __EMSCRIPTEN__
-  emscripten_get_canvas_element_size("#canvas", &width, &height);
-#else
-  width = 800;
-  height = 800;
-#endif
-
-  Renderer renderer(width, height);
-  g_renderer = &renderer;
-  if (!g_renderer->init(g_params.INITIALIZATION_RADIUS)) {
-    return -1;
+// Активные тела выбирают уровень по новому ускорению и получают толчок на
+// длину своего блока. Новый блок должен начинаться в текущем тике, поэтому
+// уровень не опускается ниже active_level.
+void kick_active_bodies(std::vector<CelestialBody>& bodies,
+                        const SimulationParameters& params, int max_level,
+                        int active_level, int* level_counts) {
+  for (auto& body : bodies) {
+    if (body.timestep_level < active_level) continue;
+    int level = std::max(choose_timestep_level(body, params, max_level),
+                         active_level);
+    // В тике 0 активны все тела, и счётчики заполняются заново
+    if (active_level > 0) {
+      --level_counts[body.timestep_level];
+    }
+    ++level_counts[level];
+    body.timestep_level = static_cast<uint8_t>(level);
+
+    Real dt = static_cast<Real>(params.DT) / (1 << level);
+    body.vx += body.ax * dt;
+    body.vy += body.ay * dt;
   }
+}
 
-#ifdef __EMSCRIPTEN__
-  emscripten::val get_initial_colors =
-      emscripten::val::global("getInitialColors");
-  emscripten::val initial_color_data = get_initial_colors();
-  const std::vector<float> color_vec =
-      emscripten::vecFromJSArray<float>(initial_color_data["colors"]);
-  const std::vector<float> weight_vec =
-      emscripten::vecFromJSArray<float>(initial_color_data["weights"]);
-  g_renderer->set_colors(color_vec, weight_vec);
-#endif
-
-#ifdef __EMSCRIPTEN__
-  static SimulationContext context_instance = {g_renderer, &g_bodies, &g_params,
-                                               &g_quadtree};
-  g_context = &context_instance;
-  emscripten_set_resize_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, g_context,
-                                 EM_FALSE, on_web_display_size_changed);
-  on_web_display_size_changed(0, nullptr, g_context);  // Initial call
-  emscripten_set_main_loop_arg(main_loop, g_context, 0, 1);
-#endif
-
-  return 0;
+// Смещает тела на dt
+void drift_bodies(std::vector<CelestialBody>& bodies, Real dt) {
+  for (auto& body : bodies) {
+    body.x += body.vx * dt;
+    body.y += body.vy * dt;
+  }
 }
 
-#ifdef __EMSCRIPTEN__
+void kick_bodies(std::vector<CelestialBody>& bodies, Real dt) {
+  for (auto& body : bodies) {
+    body.vx += body.ax * dt;
+    body.vy += body.ay * dt;
+  }
+}
 
-int get_simulation_speed() { return g_simulation_speed; }
+// Строит дерево по текущим положениям и вычисляет ускорения тел с уровнем
+// блочного шага не меньше active_level (при 0 — всех тел)
+void compute_accelerations(std::vector<CelestialBody>& bodies, Quadtree& qtree,
+                           const SimulationParameters& params,
+                           SimulationWorkspace& workspace,
+                           int active_level = 0) {
+  PhaseTimes& times = workspace.phase_times;
+
+  // Обновляем дерево по новым положениям тел (слияния этому не мешают, см.
+  // erase_collided()), а раз в TREE_REBUILD_INTERVAL обновлений или когда
+  // refit() отказывается подбираем корень по текущему положению тел,
+  // упорядочиваем их по кривой Мортона и строим квадродерево заново
+  {
+    ScopedPhase phase(times, PHASE_BUILD);
+    if (workspace.tree_refit_count + 1 < params.TREE_REBUILD_INTERVAL &&
+        qtree.refit(bodies)) {
+      ++workspace.tree_refit_count;
+    } else {
+      qtree.fit_boundary(bodies, workspace.pool);
+      qtree.build(bodies, workspace.pool);
+      workspace.tree_refit_count = 0;
+    }
+  }
+  int64_t* counters = workspace.step_counters.values;
+  counters[COUNTER_TREE_DEPTH] = qtree.get_depth();
 
-void increase_simulation_speed() { g_simulation_speed++; }
+  // Распределение массы по узлам дерева
+  {
+    ScopedPhase phase(times, PHASE_MASS_DISTRIBUTION);
+    qtree.compute_mass_distribution(workspace.pool);
+  }
 
-void decrease_simulation_speed() {
-  if (g_simulation_speed > 1) {
-    g_simulation_speed--;
+  // Вычисление сил и ускорений (алгоритмом Барнса-Хата или FMM). Тела дерева
+  // обрабатываются параллельно, тела за границами корня (build() кладёт их в
+  // конец) учитываются отдельно. FMM считает поле сразу для всех тел, поэтому
+  // применяется, только когда ускорения нужны всем. Прямое суммирование
+  // дерево не использует и сразу учитывает все тела.
+  {
+    ScopedPhase phase(times, PHASE_FORCE);
+    for (auto& body : bodies) {
+      if (body.timestep_level < active_level) continue;
+      body.ax = 0.0f;
+      body.ay = 0.0f;
+    }
+    if (params.SOLVER == SOLVER_DIRECT) {
+      workspace.direct.calculate_forces(bodies, workspace.pool, params.G,
+                                        params.SOFTENING_FACTOR, active_level);
+      return;
+    }
+    if (params.SOLVER == SOLVER_FMM && active_level == 0) {
+      workspace.fmm.calculate_forces(qtree, workspace.pool, params.FMM_ORDER,
+                                     params.THETA, params.G,
+                                     params.SOFTENING_FACTOR,
+                                     params.DETERMINISTIC != 0);
+    } else {
+      qtree.calculate_forces(workspace.pool, params.THETA, params.G,
+                             params.SOFTENING_FACTOR, active_level);
+      const ForceWalkStats& stats = qtree.get_force_stats();
+      counters[COUNTER_FORCE_BODIES] += stats.force_bodies;
+      counters[COUNTER_NODE_VISITS] += stats.node_visits;
+      counters[COUNTER_INTERACTIONS] += stats.interactions;
+    }
+    qtree.calculate_overflow_forces(workspace.pool, params.THETA, params.G,
+                                    params.SOFTENING_FACTOR, active_level);
   }
 }
 
-void set_colors(const emscripten::val& colors, const emscripten::val& weights) {
-  if (g_renderer) {
-    const std::vector<float> color_vec =
-        emscripten::vecFromJSArray<float>(colors);
-    const std::vector<float> weight_vec =
-        emscripten::vecFromJSArray<float>(weights);
-    g_renderer->set_colors(color_vec, weight_vec);
-  }
+// Полунеявный метод Эйлера: толчок по ускорению в начале шага, затем
+// смещение с новой скоростью
+void step_euler(std::vector<CelestialBody>& bodies, Quadtree& qtree,
+                const SimulationParameters& params,
+                SimulationWorkspace& workspace) {
+  compute_accelerations(bodies, qtree, params, workspace);
+  ScopedPhase phase(workspace.phase_times, PHASE_INTEGRATE);
+  kick_bodies(bodies, params.DT);
+  drift_bodies(bodies, params.DT);
+  workspace.accelerations_valid = false;
 }
 
-emscripten::val getBodies() {
-  emscripten::val bodies_val = emscripten::val::array();
-  for (const auto& body : g_bodies) {
-    emscripten::val body_obj = emscripten::val::object();
-    body_obj.set("id", body.id);
-    body_obj.set("x", body.x);
-    body_obj.set("y", body.y);
-    body_obj.set("vx", body.vx);
-    body_obj.set("vy", body.vy);
-    body_obj.set("mass", body.mass);
-    body_obj.set("radius", body.radius);
-    bodies_val.call<void>("push", body_obj);
+// Leapfrog "толчок-смещение-толчок". Ускорения в конце шага совпадают с
+// ускорениями в начале следующего, поэтому при действительных ускорениях
+// шаг стоит одного вычисления сил.
+void step_leapfrog(std::vector<CelestialBody>& bodies, Quadtree& qtree,
+                   const SimulationParameters& params,
+                   SimulationWorkspace& workspace, Real dt) {
+  if (!workspace.accelerations_valid) {
+    compute_accelerations(bodies, qtree, params, workspace);
+  }
+  {
+    ScopedPhase phase(workspace.phase_times, PHASE_INTEGRATE);
+    kick_bodies(bodies, dt / 2);
+    drift_bodies(bodies, dt);
   }
-  return bodies_val;
+  compute_accelerations(bodies, qtree, params, workspace);
+  {
+    ScopedPhase phase(workspace.phase_times, PHASE_INTEGRATE);
+    kick_bodies(bodies, dt / 2);
+  }
+  workspace.accelerations_valid = true;
+}
+
+// Метод Йошиды 4-го порядка: три шага leapfrog с весами w1, w0, w1, где
+// w1 = 1 / (2 - 2^(1/3)), w0 = 1 - 2 w1. Стоит трёх вычислений сил на шаг.
+void step_yoshida(std::vector<CelestialBody>& bodies, Quadtree& qtree,
+                  const SimulationParameters& params,
+                  SimulationWorkspace& workspace) {
+  const Real w1 = static_cast<Real>(1.0 / (2.0 - std::cbrt(2.0)));
+  const Real w0 = 1 - 2 * w1;
+  step_leapfrog(bodies, qtree, params, workspace, w1 * params.DT);
+  step_leapfrog(bodies, qtree, params, workspace, w0 * params.DT);
+  step_leapfrog(bodies, qtree, params, workspace, w1 * params.DT);
 }
 
-void setBodies(const emscripten::val& bodies_val) {
-  g_bodies.clear();
-  const int body_count = bodies_val["length"].as<int>();
-  for (int i = 0; i < body_count; ++i) {
-    emscripten::val body_obj = bodies_val[i];
-    CelestialBody body;
-    body.id = body_obj["id"].as<int>();
-    body.x = body_obj["x"].as<float>();
-    body.y = body_obj["y"].as<float>();
-    body.vx = body_obj["vx"].as<float>();
-    body.vy = body_obj["vy"].as<float>();
-    body.mass = body_obj["mass"].as<float>();
-    body.radius = body_obj["radius"].as<float>();
-    g_bodies.push_back(body);
+// Блочные шаги: DT делится на 2^MAX_TIMESTEP_LEVEL тиков, тело с уровнем k
+// получает силы и скорость в начале каждого своего блока из
+// 2^(MAX_TIMESTEP_LEVEL - k) тиков, а между ними движется равномерно. Так
+// каждое тело интегрируется полунеявным методом Эйлера со своим шагом. В тике
+// 0 блоки всех уровней начинаются одновременно, и силы нужны всем телам. Тики
+// без активных тел пропускаются, их смещение накапливается.
+void step_block(std::vector<CelestialBody>& bodies, Quadtree& qtree,
+                const SimulationParameters& params,
+                SimulationWorkspace& workspace) {
+  PhaseTimes& times = workspace.phase_times;
+  const int max_level = std::min(params.MAX_TIMESTEP_LEVEL, kMaxTimestepLevel);
+  const int tick_count = 1 << max_level;
+  const Real tick_dt = static_cast<Real>(params.DT) / tick_count;
+  int level_counts[kMaxTimestepLevel + 1] = {};
+  int pending_ticks = 0;
+  for (int tick = 0; tick < tick_count; ++tick) {
+    const int active_level = first_active_level(tick, max_level);
+    if (tick > 0 && !has_bodies_at_level(level_counts, active_level)) {
+      ++pending_ticks;
+      continue;
+    }
+    if (pending_ticks > 0) {
+      ScopedPhase phase(times, PHASE_INTEGRATE);
+      drift_bodies(bodies, pending_ticks * tick_dt);
+    }
+    compute_accelerations(bodies, qtree, params, workspace, active_level);
+    {
+      ScopedPhase phase(times, PHASE_INTEGRATE);
+      kick_active_bodies(bodies, params, max_level, active_level,
+                         level_counts);
+    }
+    pending_ticks = 1;
+  }
+  {
+    ScopedPhase phase(times, PHASE_INTEGRATE);
+    drift_bodies(bodies, pending_ticks * tick_dt);
   }
+  workspace.accelerations_valid = false;
 }
 
-EMSCRIPTEN_BINDINGS(simulation_module) {
-  emscripten::value_object<SimulationParameters>("SimulationParameters")
-      .field("G", &SimulationParameters::G)
-      .field("DENSITY", &SimulationParameters::DENSITY)
-      .field("NUM_BODIES", &SimulationParameters::NUM_BODIES)
-      .field("INITIALIZATION_RADIUS",
-             &SimulationParameters::INITIALIZATION_RADIUS)
-      .field("DT", &SimulationParameters::DT)
-      .field("SOFTENING_FACTOR", &SimulationParameters::SOFTENING_FACTOR)
-      .field("MAX_MASS", &SimulationParameters::MAX_MASS)
-      .field("MIN_MASS", &SimulationParameters::MIN_MASS)
-      .field("CENTRAL_BODY_MASS", &SimulationParameters::CENTRAL_BODY_MASS)
-      .field("THETA", &SimulationParameters::THETA);
-
-  emscripten::function("getSimulationParameters",
-                       emscripten::select_overload<SimulationParameters()>(
-                           []() -> SimulationParameters { return g_params; }));
-
-  emscripten::function("setSimulationParameters",
-                       emscripten::select_overload<void(SimulationParameters)>(
-                           [](SimulationParameters new_params) {
-                             g_params = new_params;
-                             if (g_renderer) {
-                               g_renderer->set_initialization_radius(
-                                   new_params.INITIALIZATION_RADIUS);
-                               g_renderer->reset_zoom();
-                             }
-                             reset_simulation();
-                           }));
-
-  emscripten::function("resetSimulationToDefaults",
-                       &reset_simulation_to_defaults);
-  emscripten::function("resetSimulation", &reset_simulation);
-  emscripten::function("isStateLoaded", &isStateLoaded);
-  emscripten::function("markStateAsLoaded", &markStateAsLoaded);
-  emscripten::function("getSimulationSpeed", &get_simulation_speed);
-  emscripten::function("increaseSimulationSpeed", &increase_simulation_speed);
-  emscripten::function("decreaseSimulationSpeed", &decrease_simulation_speed);
-  emscripten::function("setColors", &set_colors);
-  emscripten::function("getBodies", &getBodies);
-  emscripten::function("setBodies", &setBodies);
+}  // namespace
+
+void calculate_accelerations(std::vector<CelestialBody>& bodies,
+                             Quadtree& qtree,
+                             const SimulationParameters& params,
+                             SimulationWorkspace& workspace) {
+  workspace.pool.set_num_threads(params.NUM_THREADS);
+  workspace.tree_refit_count = params.TREE_REBUILD_INTERVAL;
+  compute_accelerations(bodies, qtree, params, workspace);
+}
+
+// Функция для обновления состояния симуляции на один шаг
+void update_simulation(std::vector<CelestialBody>& bodies, Quadtree& qtree,
+                       const SimulationParameters& params,
+                       SimulationWorkspace& workspace) {
+  workspace.pool.set_num_threads(params.NUM_THREADS);
+  PhaseTimes& times = workspace.phase_times;
+  ++times.step_count;
+  ++workspace.step_count;
+  const PhaseTimes start_times = times;
+  StepCounters& counters = workspace.step_counters;
+  counters.clear();
+
+  // 1. Проверка столкновений и слияние. Пары ищет отдельная сетка, дерево
+  // для этого не нужно.
+  {
+    ScopedPhase phase(times, PHASE_COLLIDE);
+    workspace.merge_events.clear();
+    counters.values[COUNTER_MERGES] = merge_colliding_bodies(
+        bodies, workspace.broad_phase, params, workspace.step_count,
+        workspace.merge_events);
+    counters.values[COUNTER_PAIR_TESTS] =
+        workspace.broad_phase.get_pair_test_count();
+    // Ускорения уцелевших тел ещё включают притяжение поглощённых, и
+    // leapfrog должен посчитать их заново
+    if (counters.values[COUNTER_MERGES] > 0) {
+      workspace.accelerations_valid = false;
+    }
+  }
+
+  // 2. Удаление "слипшихся" тел. Дерево сдвигает диапазоны листьев вместе с
+  // телами, чтобы его можно было обновить, а не строить заново.
+  {
+    ScopedPhase phase(times, PHASE_COLLIDE);
+    qtree.erase_collided(bodies);
+  }
+
+  // 3. Построение дерева, вычисление сил и обновление скоростей и положений
+  // выбранным интегратором. Блочные шаги заменяют интегратор, если заданы.
+  if (params.MAX_TIMESTEP_LEVEL > 0) {
+    step_block(bodies, qtree, params, workspace);
+  } else if (params.INTEGRATOR == INTEGRATOR_LEAPFROG) {
+    step_leapfrog(bodies, qtree, params, workspace, params.DT);
+  } else if (params.INTEGRATOR == INTEGRATOR_YOSHIDA) {
+    step_yoshida(bodies, qtree, params, workspace);
+  } else {
+    step_euler(bodies, qtree, params, workspace);
+  }
+
+  workspace.profile.add_step(start_times, times, counters);
 }
-#endif
@@ -1,27 +1,54 @@
 #ifndef SIMULATION_H
 #define SIMULATION_H
 
+#include <cstdint>
+#include <random>
 #include <vector>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/bind.h>
 #endif
 
+#include "broad_phase.h"
+#include "direct_solver.h"
+#include "fmm.h"
+#include "precision.h"
+#include "profiler.h"
 #include "quadtree.h"
+#include "thread_pool.h"
 
 // Структура для представления небесного тела
 struct CelestialBody {
   int id;
-  float x, y;             // Положение
-  float vx, vy;           // Скорость
+  Real x, y;              // Положение
+  Real vx, vy;            // Скорость
   float mass;             // Масса
   float radius;           // Радиус
   bool collided = false;  // флаг для удаления
+  // Уровень блочного шага: тело шагает с DT / 2^timestep_level
+  uint8_t timestep_level = 0;
 
   // Ускорение (вычисляется на каждом шаге)
-  float ax = 0.0f, ay = 0.0f;
+  Real ax = 0.0f, ay = 0.0f;
 };
 
+// Метод расчёта гравитации
+enum GravitySolver {
+  SOLVER_BARNES_HUT = 0,  // обход дерева для каждого тела, O(N log N)
+  SOLVER_FMM = 1,         // метод быстрых мультиполей, O(N)
+  SOLVER_DIRECT = 2,      // прямое суммирование всех пар, O(N^2), эталон
+};
+
+// Метод интегрирования движения
+enum Integrator {
+  INTEGRATOR_EULER = 0,     // полунеявный Эйлер, 1-й порядок
+  INTEGRATOR_LEAPFROG = 1,  // leapfrog KDK, 2-й порядок
+  INTEGRATOR_YOSHIDA = 2,   // Йошида, 4-й порядок, три вычисления сил
+};
+
+// Наибольший допустимый уровень блочного шага
+constexpr int kMaxTimestepLevel = 10;
+
 // Структура для хранения параметров симуляции
 struct SimulationParameters {
   float G = 10.0f;        // Гравитационная постоянная
@@ -34,22 +61,107 @@ struct SimulationParameters {
   float MAX_MASS = 0.1f;              // Максимальная масса
   float MIN_MASS = 0.001f;            // Минимальная масса
   float CENTRAL_BODY_MASS = 1000.0f;  // Масса центрального объекта
-  float THETA = 0.5f;                 // Точность для алгоритма Барнса-Хата
+  float THETA = 0.7f;                 // Точность для алгоритма Барнса-Хата
+  int NUM_THREADS = 0;  // Количество потоков (0 — по числу ядер)
+  int SOLVER = SOLVER_BARNES_HUT;  // Метод расчёта гравитации
+  int FMM_ORDER = 4;               // Порядок разложений FMM
+  int INTEGRATOR = INTEGRATOR_LEAPFROG;  // Метод интегрирования
+  // Дерево строится заново раз в столько обновлений, а между ними только
+  // обновляется по новым положениям тел (1 — строить каждый раз)
+  int TREE_REBUILD_INTERVAL = 8;
+  // Блочные шаги: тело шагает с DT / 2^k, k <= MAX_TIMESTEP_LEVEL, так что
+  // DT / 2^k <= TIMESTEP_ACCURACY * sqrt(SOFTENING_FACTOR / |a|)
+  // (0 — общий шаг DT для всех тел и метод INTEGRATOR)
+  int MAX_TIMESTEP_LEVEL = 0;
+  float TIMESTEP_ACCURACY = 0.025f;
+  int SEED = 0;  // Зерно генератора начальных тел (0 — от текущего времени)
+  // Воспроизводимый режим: разбиение работы между потоками не зависит от их
+  // числа, и прогоны с одним SEED дают побитово одинаковые тела
+  int DETERMINISTIC = 0;
+};
+
+// Вершина для отрисовки тела: только то, что читают шейдеры. Вершина может
+// объединять несколько тел (см. Quadtree::collect_visible_vertices()), тогда
+// размер и цвет задаются отдельно.
+struct BodyVertex {
+  float x, y;
+  float radius;        // радиус точки
+  float color_radius;  // радиус, по которому выбирается цвет
 };
 
+// Слияние тел: тело absorbed_id поглощено телом absorber_id на шаге step
+struct MergeEvent {
+  int absorber_id;
+  int absorbed_id;
+  int64_t step;
+};
+
+// Данные, переиспользуемые между шагами симуляции
+struct SimulationWorkspace {
+  ThreadPool pool;
+  BroadPhase broad_phase;
+  FmmSolver fmm;
+  DirectSolver direct;
+  PhaseTimes phase_times;  // накапливается, пока его не очистят
+  StepCounters step_counters;  // счётчики последнего шага
+  PerformanceProfile profile;  // скользящая статистика последних шагов
+  // Слияния последнего шага
+  std::vector<MergeEvent> merge_events;
+  // Ускорения тел соответствуют их текущим положениям (после шага leapfrog),
+  // и следующий шаг может их переиспользовать. Сбрасывается при замене тел
+  // и после слияний.
+  bool accelerations_valid = false;
+  // Обновлений дерева без полного построения
+  int tree_refit_count = 0;
+  // Шагов с начала симуляции, сохраняется в контрольной точке
+  int64_t step_count = 0;
+  // Генератор случайных чисел симуляции; его состояние тоже сохраняется в
+  // контрольной точке, чтобы продолжение прогона не зависело от перезапуска
+  std::mt19937 rng;
+};
+
+// Упакованный формат обмена телами с JavaScript и для сохранения состояния:
+// на тело kPackedBodyWords 32-битных слов {x, y, vx, vy, mass, id, radius},
+// id хранится как int32 в битах float
+constexpr int kPackedBodyWords = 7;
+
 // Объявление функций
+// Начальное распределение тел из генератора, состояние которого продолжается
+void initialize_bodies(std::vector<CelestialBody>& bodies,
+                       const SimulationParameters& params,
+                       std::mt19937& generator);
+// То же с генератором, засеянным get_random_seed(params)
 void initialize_bodies(std::vector<CelestialBody>& bodies,
                        const SimulationParameters& params);
+// SEED или текущее время, если SEED = 0
+uint32_t get_random_seed(const SimulationParameters& params);
+// Хеш id, положений, скоростей, масс и радиусов тел в порядке массива для
+// сравнения прогонов
+uint64_t hash_bodies(const std::vector<CelestialBody>& bodies);
 void update_simulation(std::vector<CelestialBody>& bodies, Quadtree& qtree,
-                       const SimulationParameters& params);
+                       const SimulationParameters& params,
+                       SimulationWorkspace& workspace);
+// Вычисляет ускорения всех тел по текущим положениям методом params.SOLVER,
+// не сдвигая тела. Дерево строится заново и может переставить тела в массиве.
+void calculate_accelerations(std::vector<CelestialBody>& bodies,
+                             Quadtree& qtree,
+                             const SimulationParameters& params,
+                             SimulationWorkspace& workspace);
+// Вершины всех тел по одной на тело, когда отобрать видимые по дереву нельзя
+void write_body_vertices(const std::vector<CelestialBody>& bodies,
+                         std::vector<BodyVertex>& vertices);
+void pack_bodies(const std::vector<CelestialBody>& bodies,
+                 std::vector<float>& packed);
+void unpack_bodies(const float* packed, int body_count,
+                   std::vector<CelestialBody>& bodies);
 
 bool isStateLoaded();
 void markStateAsLoaded();
 void initializeSimulation();
 
 #ifdef __EMSCRIPTEN__
-emscripten::val getBodies();
-void setBodies(const emscripten::val& bodies_val);
+emscripten::val getBodyData();
+void setBodyData(const emscripten::val& data);
 #endif
 
 #endif  // SIMULATION_H
@@ -0,0 +1,70 @@
+#include "snapshot_buffer.h"
+
+#include <algorithm>
+
+void write_snapshot(const std::vector<CelestialBody>& bodies,
+                    int64_t step_count, Snapshot& snapshot) {
+  write_body_vertices(bodies, snapshot.vertices);
+  snapshot.ids.resize(bodies.size());
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    snapshot.ids[i] = bodies[i].id;
+  }
+  snapshot.step_count = step_count;
+}
+
+void write_snapshot(const std::vector<CelestialBody>& bodies,
+                    const Quadtree& qtree, const RenderView& view,
+                    int64_t step_count, Snapshot& snapshot) {
+  if (!qtree.collect_visible_vertices(bodies, view, snapshot.vertices,
+                                      &snapshot.ids)) {
+    write_snapshot(bodies, step_count, snapshot);
+    return;
+  }
+  snapshot.step_count = step_count;
+}
+
+void SnapshotTripleBuffer::publish() {
+  write_ = middle_.exchange(write_ | kFreshBit, std::memory_order_acq_rel) &
+           kIndexMask;
+}
+
+bool SnapshotTripleBuffer::acquire() {
+  if ((middle_.load(std::memory_order_acquire) & kFreshBit) == 0) {
+    return false;
+  }
+  // Последний снимок переходит в previous_ обменом памяти, а память прежнего
+  // предыдущего уходит писателю, который всё равно её перезапишет
+  std::swap(previous_, buffers_[read_]);
+  read_ = middle_.exchange(read_, std::memory_order_acq_rel) & kIndexMask;
+  return true;
+}
+
+void SnapshotInterpolator::match(const Snapshot& from, const Snapshot& to) {
+  int max_id = -1;
+  for (int id : from.ids) max_id = std::max(max_id, id);
+  for (int id : to.ids) max_id = std::max(max_id, id);
+  index_by_id_.assign(max_id + 1, -1);
+  for (size_t i = 0; i < from.ids.size(); ++i) {
+    if (from.ids[i] >= 0) index_by_id_[from.ids[i]] = static_cast<int>(i);
+  }
+  from_index_.resize(to.ids.size());
+  for (size_t i = 0; i < to.ids.size(); ++i) {
+    from_index_[i] = to.ids[i] >= 0 ? index_by_id_[to.ids[i]] : -1;
+  }
+}
+
+void SnapshotInterpolator::interpolate(
+    const Snapshot& from, const Snapshot& to, float alpha,
+    std::vector<BodyVertex>& vertices) const {
+  vertices.resize(to.vertices.size());
+  for (size_t i = 0; i < to.vertices.size(); ++i) {
+    BodyVertex vertex = to.vertices[i];
+    if (i < from_index_.size() && from_index_[i] >= 0 &&
+        static_cast<size_t>(from_index_[i]) < from.vertices.size()) {
+      const BodyVertex& start = from.vertices[from_index_[i]];
+      vertex.x = start.x + (vertex.x - start.x) * alpha;
+      vertex.y = start.y + (vertex.y - start.y) * alpha;
+    }
+    vertices[i] = vertex;
+  }
+}
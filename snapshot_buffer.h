@@ -0,0 +1,73 @@
+#ifndef SNAPSHOT_BUFFER_H
+#define SNAPSHOT_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "simulation.h"
+
+// Снимок тел для отрисовки, опубликованный потоком физики
+struct Snapshot {
+  std::vector<BodyVertex> vertices;
+  std::vector<int> ids;    // id тела каждой вершины
+  int64_t step_count = 0;  // шагов симуляции к моменту снимка
+};
+
+// Заполняет снимок по телам после шага
+void write_snapshot(const std::vector<CelestialBody>& bodies,
+                    int64_t step_count, Snapshot& snapshot);
+// То же только для тел, видимых в view, см.
+// Quadtree::collect_visible_vertices(). Объединённые вершины получают id -1 и
+// не интерполируются. Если дерево построено не по этим телам, пишет все тела.
+void write_snapshot(const std::vector<CelestialBody>& bodies,
+                    const Quadtree& qtree, const RenderView& view,
+                    int64_t step_count, Snapshot& snapshot);
+
+// Тройной буфер снимков между одним писателем (поток физики) и одним
+// читателем (поток отрисовки) без блокировок. Писатель заполняет свой буфер и
+// обменивает его со средним, читатель забирает средний, если тот новее.
+// Никто не ждёт: писатель перезаписывает неподобранный снимок, читатель
+// рисует последний полученный. Память буферов переиспользуется, снимки не
+// копируются.
+class SnapshotTripleBuffer {
+ public:
+  // Буфер писателя
+  Snapshot& write_buffer() { return buffers_[write_]; }
+  void publish();
+
+  // Забирает последний опубликованный снимок, если он новый. Прежний
+  // последний снимок становится предыдущим.
+  bool acquire();
+  const Snapshot& latest() const { return buffers_[read_]; }
+  const Snapshot& previous() const { return previous_; }
+
+ private:
+  // В среднем индексе вместе с номером буфера хранится флаг нового снимка
+  static constexpr int kFreshBit = 4;
+  static constexpr int kIndexMask = 3;
+
+  Snapshot buffers_[3];
+  Snapshot previous_;  // принадлежит читателю
+  int write_ = 0;
+  int read_ = 1;
+  std::atomic<int> middle_{2};
+};
+
+// Промежуточные положения тел между двумя снимками для плавного движения,
+// когда физика шагает реже, чем обновляется экран. Тела сопоставляются по id;
+// тело, которого нет в первом снимке, рисуется по второму.
+class SnapshotInterpolator {
+ public:
+  // Сопоставляет тела снимков, вызывается при смене снимков
+  void match(const Snapshot& from, const Snapshot& to);
+  // alpha = 0 — положения from, 1 — положения to
+  void interpolate(const Snapshot& from, const Snapshot& to, float alpha,
+                   std::vector<BodyVertex>& vertices) const;
+
+ private:
+  std::vector<int> index_by_id_;  // индекс в from по id, -1 — нет
+  std::vector<int> from_index_;   // для каждой вершины to
+};
+
+#endif  // SNAPSHOT_BUFFER_H
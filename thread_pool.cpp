@@ -0,0 +1,164 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+
+uint64_t pack_range(uint32_t begin, uint32_t end) {
+  return (static_cast<uint64_t>(end) << 32) | begin;
+}
+
+int hardware_threads() {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  // Без -pthread потоки в браузере недоступны
+  return 1;
+#else
+  return std::max(1u, std::thread::hardware_concurrency());
+#endif
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads) { set_num_threads(num_threads); }
+
+ThreadPool::~ThreadPool() { stop_workers(); }
+
+void ThreadPool::set_num_threads(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = hardware_threads();
+  }
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  num_threads = 1;
+#endif
+  if (num_threads == num_threads_ && ranges_) {
+    return;
+  }
+  stop_workers();
+  start_workers(num_threads);
+}
+
+void ThreadPool::start_workers(int num_threads) {
+  num_threads_ = num_threads;
+  ranges_.reset(new ChunkRange[num_threads_]);
+  stopping_ = false;
+  for (int i = 1; i < num_threads_; ++i) {
+    workers_.emplace_back(&ThreadPool::worker_loop, this, i, generation_);
+  }
+}
+
+void ThreadPool::stop_workers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  start_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+void ThreadPool::parallel_for(int count, int grain,
+                              const std::function<void(int, int)>& fn) {
+  if (count <= 0) {
+    return;
+  }
+  grain = std::max(grain, 1);
+  const int chunk_count = (count + grain - 1) / grain;
+
+  if (num_threads_ == 1 || chunk_count == 1) {
+    for (int begin = 0; begin < count; begin += grain) {
+      fn(begin, std::min(begin + grain, count));
+    }
+    return;
+  }
+
+  // Каждому участнику достаётся непрерывная полоса блоков: соседние тела
+  // лежат рядом в памяти, поэтому так лучше используется кэш
+  for (int i = 0; i < num_threads_; ++i) {
+    uint32_t begin = static_cast<uint64_t>(chunk_count) * i / num_threads_;
+    uint32_t end = static_cast<uint64_t>(chunk_count) * (i + 1) / num_threads_;
+    ranges_[i].bounds.store(pack_range(begin, end), std::memory_order_relaxed);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = &fn;
+    job_count_ = count;
+    job_grain_ = grain;
+    pending_workers_ = static_cast<int>(workers_.size());
+    ++generation_;
+  }
+  start_cv_.notify_all();
+
+  run_chunks(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return pending_workers_ == 0; });
+  job_ = nullptr;
+}
+
+void ThreadPool::worker_loop(int participant, uint64_t seen_generation) {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cv_.wait(lock, [this, seen_generation] {
+        return stopping_ || generation_ != seen_generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+
+    run_chunks(participant);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--pending_workers_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+void ThreadPool::run_chunks(int participant) {
+  // Сначала разбираем свою полосу с начала
+  ChunkRange& own = ranges_[participant];
+  for (;;) {
+    uint64_t bounds = own.bounds.load(std::memory_order_relaxed);
+    uint32_t begin = static_cast<uint32_t>(bounds);
+    uint32_t end = static_cast<uint32_t>(bounds >> 32);
+    if (begin >= end) {
+      break;
+    }
+    if (own.bounds.compare_exchange_weak(bounds, pack_range(begin + 1, end),
+                                         std::memory_order_acq_rel)) {
+      run_chunk(begin);
+    }
+  }
+
+  // Затем забираем блоки с конца чужих полос, пока работа не кончится
+  bool found = true;
+  while (found) {
+    found = false;
+    for (int offset = 1; offset < num_threads_; ++offset) {
+      ChunkRange& victim = ranges_[(participant + offset) % num_threads_];
+      uint64_t bounds = victim.bounds.load(std::memory_order_relaxed);
+      uint32_t begin = static_cast<uint32_t>(bounds);
+      uint32_t end = static_cast<uint32_t>(bounds >> 32);
+      if (begin >= end) {
+        continue;
+      }
+      if (victim.bounds.compare_exchange_weak(
+              bounds, pack_range(begin, end - 1), std::memory_order_acq_rel)) {
+        run_chunk(end - 1);
+      }
+      found = true;
+      break;
+    }
+  }
+}
+
+void ThreadPool::run_chunk(int chunk) {
+  int begin = chunk * job_grain_;
+  (*job_)(begin, std::min(begin + job_grain_, job_count_));
+}
@@ -0,0 +1,62 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков для параллельных циклов симуляции. Вызывающий поток тоже
+// участвует в работе, поэтому пул из одного потока выполняет всё на месте.
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads = 1);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // 0 — по числу аппаратных потоков
+  void set_num_threads(int num_threads);
+  int get_num_threads() const { return num_threads_; }
+
+  // Делит [0, count) на блоки по grain элементов и вызывает fn(begin, end)
+  // для каждого блока. Блоки раздаются потокам непрерывными полосами, а
+  // освободившийся поток забирает блоки с конца чужих полос. Вложенные вызовы
+  // не поддерживаются.
+  void parallel_for(int count, int grain,
+                    const std::function<void(int, int)>& fn);
+
+ private:
+  // Полоса блоков участника: начало в младших 32 битах, конец — в старших
+  struct alignas(64) ChunkRange {
+    std::atomic<uint64_t> bounds{0};
+  };
+
+  int num_threads_ = 1;
+  std::vector<std::thread> workers_;
+  std::unique_ptr<ChunkRange[]> ranges_;
+
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  uint64_t generation_ = 0;
+  int pending_workers_ = 0;
+  bool stopping_ = false;
+
+  const std::function<void(int, int)>* job_ = nullptr;
+  int job_count_ = 0;
+  int job_grain_ = 1;
+
+  void start_workers(int num_threads);
+  void stop_workers();
+  void worker_loop(int participant, uint64_t seen_generation);
+  void run_chunks(int participant);
+  void run_chunk(int chunk);
+};
+
+#endif  // THREAD_POOL_H
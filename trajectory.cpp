@@ -0,0 +1,190 @@
+#include "trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include "async_writer.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'O', 'L', 'A', 'R', 'T', 'R', 'J'};
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kEndianTag = 0x01020304;
+constexpr int64_t kMinOffset = std::numeric_limits<int32_t>::min();
+constexpr int64_t kMaxOffset = std::numeric_limits<int32_t>::max();
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian_tag;
+  double quantum;
+  uint32_t every;
+  uint32_t reserved;
+};
+static_assert(sizeof(FileHeader) == 32, "header must stay 32 bytes");
+
+template <typename T>
+void append(std::vector<char>& data, const T& value) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+// Ставит запись байтов в файл; false, если очередь полна и blocking не задан
+bool submit_bytes(AsyncWriter& writer, std::shared_ptr<std::FILE> file,
+                  std::vector<char> data, bool blocking) {
+  const size_t bytes = data.size();
+  auto task = [file, data = std::move(data)] {
+    if (std::fwrite(data.data(), 1, data.size(), file.get()) != data.size()) {
+      std::cerr << "Failed to write trajectory frame" << std::endl;
+    }
+  };
+  if (blocking) {
+    writer.submit(std::move(task), bytes);
+    return true;
+  }
+  return writer.try_submit(std::move(task), bytes);
+}
+
+}  // namespace
+
+TrajectoryWriter::TrajectoryWriter(AsyncWriter& writer, double quantum,
+                                   int every)
+    : writer_(writer), quantum_(quantum), every_(std::max(every, 1)) {}
+
+bool TrajectoryWriter::open(const std::string& path) {
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Failed to create trajectory file: " << path << std::endl;
+    return false;
+  }
+  file_.reset(file, std::fclose);
+
+  FileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.endian_tag = kEndianTag;
+  header.quantum = quantum_;
+  header.every = static_cast<uint32_t>(every_);
+  std::vector<char> data;
+  append(data, header);
+  submit_bytes(writer_, file_, std::move(data), true);
+  return true;
+}
+
+void TrajectoryWriter::record(const std::vector<CelestialBody>& bodies,
+                              const SimulationWorkspace& workspace) {
+  if (!file_) {
+    return;
+  }
+  pending_merges_.insert(pending_merges_.end(),
+                         workspace.merge_events.begin(),
+                         workspace.merge_events.end());
+  // Первый кадр пишется сразу, чтобы в потоке было начальное состояние
+  if (written_frames_ == 0 || workspace.step_count % every_ == 0) {
+    write_frame(bodies, workspace.step_count);
+  }
+}
+
+void TrajectoryWriter::write_frame(const std::vector<CelestialBody>& bodies,
+                                   int64_t step) {
+  // Начало отсчёта — центр рамки тел, округлённый до кванта
+  double min_x = 0.0, max_x = 0.0, min_y = 0.0, max_y = 0.0;
+  int max_id = -1;
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    const CelestialBody& body = bodies[i];
+    if (i == 0 || body.x < min_x) min_x = body.x;
+    if (i == 0 || body.x > max_x) max_x = body.x;
+    if (i == 0 || body.y < min_y) min_y = body.y;
+    if (i == 0 || body.y > max_y) max_y = body.y;
+    max_id = std::max(max_id, body.id);
+  }
+  TrajectoryFrameHeader header;
+  std::memcpy(header.magic, "FRME", sizeof(header.magic));
+  header.step = step;
+  header.origin_x = std::llround((min_x + max_x) * 0.5 / quantum_);
+  header.origin_y = std::llround((min_y + max_y) * 0.5 / quantum_);
+  header.body_count = bodies.size();
+  header.reserved = 0;
+  if (static_cast<int>(states_.size()) <= max_id) {
+    states_.resize(max_id + 1);
+  }
+
+  const auto fits_offset = [](int64_t offset) {
+    return offset >= kMinOffset && offset <= kMaxOffset;
+  };
+
+  std::vector<char> moved, far, resized;
+  updates_.clear();
+  for (const CelestialBody& body : bodies) {
+    const BodyState& old_state = states_[body.id];
+    BodyState state;
+    state.qx = std::llround(body.x / quantum_);
+    state.qy = std::llround(body.y / quantum_);
+    state.mass = body.mass;
+    state.radius = body.radius;
+    state.present = true;
+    const bool is_new = !old_state.present;
+    const bool is_moved =
+        is_new || state.qx != old_state.qx || state.qy != old_state.qy;
+    const bool is_resized = is_new || state.mass != old_state.mass ||
+                            state.radius != old_state.radius;
+    const int64_t dx = state.qx - header.origin_x;
+    const int64_t dy = state.qy - header.origin_y;
+    if (is_moved && fits_offset(dx) && fits_offset(dy)) {
+      append(moved, static_cast<int32_t>(body.id));
+      append(moved, static_cast<int32_t>(dx));
+      append(moved, static_cast<int32_t>(dy));
+    } else if (is_moved) {
+      append(far, static_cast<int32_t>(body.id));
+      append(far, static_cast<int32_t>(0));
+      append(far, state.qx);
+      append(far, state.qy);
+    }
+    if (is_resized) {
+      append(resized, static_cast<int32_t>(body.id));
+      append(resized, state.mass);
+      append(resized, state.radius);
+    }
+    if (is_moved || is_resized) {
+      updates_.push_back({body.id, state});
+    }
+  }
+  header.moved_count = static_cast<uint32_t>(moved.size() / 12);
+  header.far_count = static_cast<uint32_t>(far.size() / 24);
+  header.resized_count = static_cast<uint32_t>(resized.size() / 12);
+  header.merge_count = static_cast<uint32_t>(pending_merges_.size());
+
+  std::vector<char> data;
+  data.reserve(sizeof(header) + moved.size() + far.size() + resized.size() +
+               pending_merges_.size() * 16);
+  append(data, header);
+  data.insert(data.end(), moved.begin(), moved.end());
+  data.insert(data.end(), far.begin(), far.end());
+  data.insert(data.end(), resized.begin(), resized.end());
+  for (const MergeEvent& event : pending_merges_) {
+    append(data, static_cast<int32_t>(event.absorber_id));
+    append(data, static_cast<int32_t>(event.absorbed_id));
+    append(data, static_cast<int64_t>(event.step));
+  }
+
+  // Пропущенный кадр не меняет записанное состояние: следующий кадр будет
+  // записан относительно последнего дошедшего до файла
+  if (!submit_bytes(writer_, file_, std::move(data), false)) {
+    ++dropped_frames_;
+    return;
+  }
+  for (const BodyUpdate& update : updates_) {
+    states_[update.id] = update.state;
+  }
+  for (const MergeEvent& event : pending_merges_) {
+    if (event.absorbed_id < static_cast<int>(states_.size())) {
+      states_[event.absorbed_id].present = false;
+    }
+  }
+  pending_merges_.clear();
+  ++written_frames_;
+}
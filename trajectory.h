@@ -0,0 +1,88 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+class AsyncWriter;
+
+// Запись траекторий для разбора прогона после его окончания. Вызывается после
+// update_simulation и раз в every шагов пишет кадр с тем, что изменилось с
+// прошлого записанного кадра. Файл:
+//   заголовок (32 байта): "SOLARTRJ", версия, метка порядка байтов, шаг
+//     квантования положений (double), every;
+//   кадры: TrajectoryFrameHeader, затем moved_count записей {id, dx, dy}
+//     (int32), far_count записей {id, 0, qx, qy} (int32, int32, int64,
+//     int64), resized_count записей {id, масса, радиус} (int32, float,
+//     float) и merge_count событий слияния {поглотившее id, поглощённое id,
+//     шаг} (int32, int32, int64).
+// Положение тела — целое число квантов: (origin + d) * quantum, где origin —
+// центр рамки тел кадра в квантах. Тело, смещение которого не помещается в
+// int32 (улетевшее на миллионы единиц при кванте 0.001), записывается в far
+// полным положением qx, qy в квантах, а не в moved.
+// Тело попадает в moved (или far), если его квантованное положение
+// изменилось, и в resized, если изменились масса или радиус; новое тело
+// попадает в оба списка.
+// Поглощённые тела перечислены только в событиях слияния, которые копятся
+// между кадрами и не теряются. Первый кадр пишется при первом вызове record,
+// и тела, поглощённые до него, в потоке встречаются только в этих событиях.
+//
+// Кадры уходят в поток writer через try_submit: если очередь полна, кадр
+// пропускается, а следующий записывается относительно последнего записанного,
+// так что поток остаётся согласованным и шаги не ждут диска.
+struct TrajectoryFrameHeader {
+  char magic[4];  // "FRME"
+  uint32_t moved_count;
+  uint32_t resized_count;
+  uint32_t merge_count;
+  uint32_t far_count;
+  uint32_t reserved;
+  int64_t step;
+  int64_t origin_x, origin_y;  // в квантах
+  uint64_t body_count;
+};
+
+class TrajectoryWriter {
+ public:
+  TrajectoryWriter(AsyncWriter& writer, double quantum, int every);
+
+  // Создаёт файл и ставит запись заголовка в очередь
+  bool open(const std::string& path);
+  // Копит слияния шага и раз в every шагов пишет кадр
+  void record(const std::vector<CelestialBody>& bodies,
+              const SimulationWorkspace& workspace);
+
+  int64_t get_written_frames() const { return written_frames_; }
+  int64_t get_dropped_frames() const { return dropped_frames_; }
+
+ private:
+  // Последнее записанное состояние тела
+  struct BodyState {
+    int64_t qx = 0, qy = 0;
+    float mass = 0.0f, radius = 0.0f;
+    bool present = false;
+  };
+  struct BodyUpdate {
+    int id;
+    BodyState state;
+  };
+
+  AsyncWriter& writer_;
+  double quantum_;
+  int every_;
+  std::shared_ptr<std::FILE> file_;
+  std::vector<BodyState> states_;  // по id тела
+  std::vector<MergeEvent> pending_merges_;
+  std::vector<BodyUpdate> updates_;
+  int64_t written_frames_ = 0;
+  int64_t dropped_frames_ = 0;
+
+  void write_frame(const std::vector<CelestialBody>& bodies, int64_t step);
+};
+
+#endif  // TRAJECTORY_H